@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,45 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts a single countdown of COUNT PIT cycles on channel 0
+   (mode 0), which raises the timer interrupt once when it
+   reaches zero.  Interrupts must be off.  Restore periodic
+   interrupts with pit_configure_channel(). */
+void
+pit_oneshot (uint16_t count)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  outb (PIT_PORT_CONTROL, 0x30);
+  outb (PIT_PORT_COUNTER (0), count);
+  outb (PIT_PORT_COUNTER (0), count >> 8);
+}
+
+/* Returns the current count of channel 0.  Interrupts must be
+   off. */
+uint16_t
+pit_read_count (void)
+{
+  uint8_t lo, hi;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Latch the counter, then read it. */
+  outb (PIT_PORT_CONTROL, 0x00);
+  lo = inb (PIT_PORT_COUNTER (0));
+  hi = inb (PIT_PORT_COUNTER (0));
+  return lo | (hi << 8);
+}
+
+/* Returns the output of channel 0, which in mode 0 goes high
+   when the countdown reaches zero.  Interrupts must be off. */
+bool
+pit_output (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Read-back command: latch the status of channel 0. */
+  outb (PIT_PORT_CONTROL, 0xe2);
+  return (inb (PIT_PORT_COUNTER (0)) & 0x80) != 0;
+}
@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -17,9 +18,51 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* PIT cycles per timer tick. */
+#define TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Most ticks skipped by one idle countdown, which must fit the
+   16-bit PIT counter. */
+#define MAX_IDLE_TICKS (UINT16_MAX / TICK_COUNT)
+
+/* Shortest countdown programmed, in PIT cycles. */
+#define MIN_COUNT 2
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* If true, the timer does not tick while the idle thread runs,
+   and sleeps shorter than a tick block instead of busy-waiting.
+   Set by the kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* Channel 0 of the PIT was loaded with BASE_COUNT cycles at
+   BASE_TIME, in PIT cycles since boot.  Normally it runs in
+   periodic mode, reloading at every tick, and BASE_TIME is the
+   time of the last tick.  If ONESHOT, it counts down once
+   instead, to the next tick or high-resolution sleeper, or in
+   tickless mode to the next sleeper of the idle thread if
+   IDLE_ONESHOT. */
+static int64_t base_time;
+static uint16_t base_count = TICK_COUNT;
+static bool oneshot;
+static bool idle_oneshot;
+
+/* A thread in a sleep shorter than a tick. */
+struct hr_sleeper
+  {
+    struct list_elem elem;      /* Element in hr_sleepers. */
+    int64_t deadline;           /* Time to wake up, in PIT cycles. */
+    struct thread *thread;      /* Sleeping thread. */
+  };
+
+/* Threads in sleeps shorter than a tick, ordered by deadline. */
+static struct list hr_sleepers;
+
+/* Statistics. */
+static long long skipped_ticks; /* Ticks without an interrupt. */
+static long long hr_sleep_cnt;  /* Sleeps shorter than a tick. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -29,6 +72,12 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static int64_t pit_time (void);
+static void start_oneshot (int64_t now, int64_t count);
+static void arm_timer (int64_t now);
+static void hr_sleep (int64_t count);
+static bool hr_less (const struct list_elem *, const struct list_elem *,
+                     void *aux);
 int64_t timer_elapsed (int64_t then);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
@@ -37,6 +86,7 @@ void
 timer_init (void) 
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&hr_sleepers);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -100,10 +150,7 @@ timer_sleep (int64_t ticks)
     thread_yield ();
   */
   
-  thread_sleep (ticks, start);
-
-  return;
-
+  thread_sleep (start + ticks);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -174,14 +221,211 @@ void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (timer_tickless)
+    printf ("Timer: %lld ticks skipped while idle, "
+            "%lld sleeps shorter than a tick\n",
+            skipped_ticks, hr_sleep_cnt);
 }
 
+/* Called by the idle thread, with interrupts off, before it
+   halts.  In tickless mode, replaces the periodic tick by one
+   countdown to the next sleeping thread's wakeup tick, at most
+   MAX_IDLE_TICKS ahead.  The MLFQS needs every tick to age its
+   load average, so it keeps ticking. */
+void
+timer_idle_enter (void)
+{
+  int64_t wakeup, now;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || thread_mlfqs || oneshot)
+    return;
+
+  wakeup = thread_next_wakeup ();
+  if (wakeup > ticks + MAX_IDLE_TICKS)
+    wakeup = ticks + MAX_IDLE_TICKS;
+  if (wakeup <= ticks + 1)
+    return;
+
+  now = pit_time ();
+  start_oneshot (now, wakeup * TICK_COUNT - now);
+  idle_oneshot = true;
+}
+
+/* Called with interrupts off when the idle thread is switched
+   out.  If its countdown is still running, accounts for the
+   ticks that passed without an interrupt and returns to
+   ticking. */
+void
+timer_idle_exit (void)
+{
+  int64_t now;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!idle_oneshot)
+    return;
+  idle_oneshot = false;
+
+  /* If the countdown ran out, the pending interrupt catches up. */
+  if (pit_output ())
+    return;
+
+  now = pit_time ();
+  if (now / TICK_COUNT > ticks)
+    {
+      skipped_ticks += now / TICK_COUNT - ticks;
+      ticks = now / TICK_COUNT;
+    }
+  arm_timer (now);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  int64_t now;
+  bool expired = false;
+
+  if (!oneshot)
+    {
+      /* Periodic tick. */
+      now = base_time + TICK_COUNT;
+      base_time = now;
+    }
+  else if (pit_output ())
+    {
+      /* The countdown ran out. */
+      now = base_time + base_count;
+      idle_oneshot = false;
+      expired = true;
+    }
+  else
+    {
+      /* A periodic tick raised just before the switch to a
+         countdown, already counted in BASE_TIME. */
+      now = pit_time ();
+    }
+
+  /* Wake high-resolution sleepers that are due. */
+  while (!list_empty (&hr_sleepers))
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline > now)
+        break;
+      list_pop_front (&hr_sleepers);
+      thread_unblock (s->thread);
+      intr_yield_on_return ();
+    }
+
+  if (expired)
+    arm_timer (now);
+
+  if (now / TICK_COUNT > ticks)
+    {
+      skipped_ticks += now / TICK_COUNT - ticks - 1;
+      ticks = now / TICK_COUNT;
+      thread_wake (ticks);
+      thread_tick ();
+    }
+}
+
+/* Returns the time since boot in PIT cycles.  Interrupts must be
+   off. */
+static int64_t
+pit_time (void)
+{
+  uint16_t left = pit_read_count ();
+  int64_t elapsed = base_count - left;
+
+  if (!oneshot)
+    {
+      /* The counter reloads as soon as it raises the interrupt,
+         before the handler advances BASE_TIME. */
+      if (intr_ext_pending (0x20) && elapsed < TICK_COUNT / 2)
+        elapsed += TICK_COUNT;
+    }
+  else if (left > base_count)
+    {
+      /* The countdown ran out and the counter wrapped around. */
+      elapsed = base_count;
+    }
+  return base_time + elapsed;
+}
+
+/* Makes channel 0 raise one interrupt COUNT PIT cycles after
+   NOW. */
+static void
+start_oneshot (int64_t now, int64_t count)
+{
+  if (count < MIN_COUNT)
+    count = MIN_COUNT;
+  ASSERT (count <= UINT16_MAX);
+
+  pit_oneshot (count);
+  base_time = now;
+  base_count = count;
+  oneshot = true;
+}
+
+/* Programs channel 0 for the first event after NOW: the next
+   tick, or an earlier high-resolution sleeper.  Returns to
+   periodic ticks if NOW is a tick and no sleeper is due before
+   the next one. */
+static void
+arm_timer (int64_t now)
+{
+  int64_t next = (now / TICK_COUNT + 1) * TICK_COUNT;
+
+  if (!list_empty (&hr_sleepers))
+    {
+      int64_t deadline = list_entry (list_front (&hr_sleepers),
+                                     struct hr_sleeper, elem)->deadline;
+      if (deadline < next)
+        next = deadline;
+    }
+  else if (now % TICK_COUNT == 0)
+    {
+      pit_configure_channel (0, 2, TIMER_FREQ);
+      base_time = now;
+      base_count = TICK_COUNT;
+      oneshot = false;
+      return;
+    }
+  start_oneshot (now, next - now);
+}
+
+/* Blocks the current thread for COUNT PIT cycles, less than a
+   tick, moving the next timer interrupt up if needed. */
+static void
+hr_sleep (int64_t count)
+{
+  struct hr_sleeper s;
+  enum intr_level old_level = intr_disable ();
+  int64_t now = pit_time ();
+  int64_t expiry = oneshot ? base_time + base_count
+                           : (now / TICK_COUNT + 1) * TICK_COUNT;
+
+  s.deadline = now + count;
+  s.thread = thread_current ();
+  list_insert_ordered (&hr_sleepers, &s.elem, hr_less, NULL);
+  hr_sleep_cnt++;
+
+  if (s.deadline < expiry)
+    start_oneshot (now, s.deadline - now);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Orders hr_sleepers by deadline. */
+static bool
+hr_less (const struct list_elem *a, const struct list_elem *b,
+         void *aux UNUSED)
+{
+  return list_entry (a, struct hr_sleeper, elem)->deadline
+         < list_entry (b, struct hr_sleeper, elem)->deadline;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -237,6 +481,11 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (timer_tickless)
+    {
+      /* Block until a one-shot timer interrupt at the deadline. */
+      hr_sleep (num * PIT_HZ / denom);
+    }
   else 
     {
       /* Otherwise, use a busy-wait loop for more accurate
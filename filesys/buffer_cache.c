@@ -12,6 +12,17 @@ struct buffer_head buffer_head [BUFFER_CACHE_ENTRY_NB];
 /* Victim entry chooser at clock algorithm. */
 unsigned int clock_hand;
 
+/* Protects which sector each entry caches, the busy flags and
+   clock_hand.  Entry data is protected by each entry's head_lock.
+   bc_lock is never held while waiting for a head_lock or for the
+   disk, but may be acquired while holding a head_lock. */
+static struct lock bc_lock;
+
+/* Signalled when an entry stops being busy. */
+static struct condition bc_busy_cond;
+
+static struct buffer_head *bc_get (block_sector_t, bool write);
+
 void
 bc_init (void)
 {
@@ -27,11 +38,13 @@ bc_init (void)
     buffer_head [i].data = p_buffer_cache;
     buffer_head [i].sector = 0;
     buffer_head [i].valid = false;
-    buffer_head [i].victim = false;
-    lock_init (&buffer_head [i].head_lock);
+    buffer_head [i].busy = false;
+    rwlock_init (&buffer_head [i].head_lock);
     //printf ("buffer_head [%d].data = %p\n", i, &buffer_head [i].data);
   }
   clock_hand = 0;
+  lock_init (&bc_lock);
+  cond_init (&bc_busy_cond);
 }
 
 /* Flush cached data to Disk block. */
@@ -52,27 +65,14 @@ bool
 bc_read (block_sector_t sector_idx, void *buffer,
          off_t bytes_read, int chunk_size, int sector_ofs)
 {
-  /* Search sector_idx in buffer_head. */
-  struct buffer_head *head_ptr = bc_lookup (sector_idx);
-  /* If it isn't exist, find victim. */
-  if (head_ptr == NULL)
-  {
-    head_ptr = bc_select_victim ();
-    lock_acquire (&head_ptr->head_lock);
-    head_ptr->sector = sector_idx;
-    head_ptr->valid = true;
-    head_ptr->victim = false;
-    block_read (fs_device, sector_idx, head_ptr->data);
-  }
-  else
-    lock_acquire (&head_ptr->head_lock);
+  struct buffer_head *head_ptr = bc_get (sector_idx, false);
 
   /* Using memcpy to copy disk block data to buffer. */
   memcpy (buffer + bytes_read, head_ptr->data + sector_ofs, chunk_size);
 
   /* clock_bit setting. */
   head_ptr->clock_bit = true;
-  lock_release (&head_ptr->head_lock);
+  rwlock_release_read (&head_ptr->head_lock);
 
   return true;
 }
@@ -82,78 +82,129 @@ bool
 bc_write (block_sector_t sector_idx, void *buffer,
           off_t bytes_written, int chunk_size, int sector_ofs)
 {
-  /* Search sector_ids in buffer_head and copy to buffer cache. */
-  struct buffer_head *head_ptr = bc_lookup (sector_idx);
-  if (head_ptr == NULL)
-  {
-    head_ptr = bc_select_victim ();
-    lock_acquire (&head_ptr->head_lock);
-    head_ptr->valid = true;
-    head_ptr->victim = false;
-    head_ptr->sector = sector_idx;
-    block_read (fs_device, sector_idx, head_ptr->data);
-  }
-  else
-    lock_acquire (&head_ptr->head_lock);
+  struct buffer_head *head_ptr = bc_get (sector_idx, true);
 
   memcpy (head_ptr->data + sector_ofs, buffer + bytes_written, chunk_size);
 
   /* Update buffer head. */
   head_ptr->clock_bit = true;
   head_ptr->dirty = true;
-  lock_release (&head_ptr->head_lock);
+  rwlock_release_write (&head_ptr->head_lock);
 
   return true;
 }
 
-/* Choose victim entry using clock algorithm. 
-   If victim entry is dirty, flush data to disk. */
-struct buffer_head *
-bc_select_victim (void)
+/* Returns the entry caching SECTOR, reading the sector in if it
+   is not cached, with the entry's head_lock held for writing if
+   WRITE is true, otherwise for reading. */
+static struct buffer_head *
+bc_get (block_sector_t sector, bool write)
 {
-  /* Choose victim using clock algorithm. */
-  /* Traverse buffer_head and check clock_bit. */
+  struct buffer_head *head_ptr;
 
-  /* If empty cache is exist, then return. */
-  unsigned int i = 0;
-  for (i = 0; i < BUFFER_CACHE_ENTRY_NB; i++)
+  for (;;)
   {
-    if (buffer_head [i].valid == false && buffer_head [i].victim == false)
-      return &buffer_head [i];
+    lock_acquire (&bc_lock);
+    head_ptr = bc_lookup (sector);
+    if (head_ptr == NULL)
+    {
+      head_ptr = bc_select_victim ();
+      lock_release (&bc_lock);
+
+      /* Users of the old sector finish first.  Until its data is
+         on disk, the entry still caches it. */
+      rwlock_acquire_write (&head_ptr->head_lock);
+      if (head_ptr->valid && head_ptr->dirty)
+        bc_flush_entry (head_ptr);
+
+      lock_acquire (&bc_lock);
+      head_ptr->busy = false;
+      cond_signal (&bc_busy_cond, &bc_lock);
+      if (bc_lookup (sector) != NULL)
+      {
+        /* Another thread read SECTOR in meanwhile. */
+        lock_release (&bc_lock);
+        rwlock_release_write (&head_ptr->head_lock);
+        continue;
+      }
+
+      /* Threads that find the entry from now on wait on its
+         head_lock until the sector is read in. */
+      head_ptr->sector = sector;
+      head_ptr->valid = true;
+      head_ptr->clock_bit = true;
+      lock_release (&bc_lock);
+      block_read (fs_device, sector, head_ptr->data);
+      if (!write)
+        rwlock_downgrade (&head_ptr->head_lock);
+      return head_ptr;
+    }
+    lock_release (&bc_lock);
+
+    if (write)
+      rwlock_acquire_write (&head_ptr->head_lock);
+    else
+      rwlock_acquire_read (&head_ptr->head_lock);
+
+    /* The entry may have been evicted before we got its lock. */
+    if (head_ptr->valid && head_ptr->sector == sector)
+      return head_ptr;
+
+    if (write)
+      rwlock_release_write (&head_ptr->head_lock);
+    else
+      rwlock_release_read (&head_ptr->head_lock);
   }
+}
+
+/* Choose victim entry using clock algorithm, preferring empty
+   entries, and mark it busy so that no other thread chooses it.
+   Waits while every entry is busy.  The victim keeps caching its
+   sector, bc_get () flushes it without bc_lock before reusing
+   it.  bc_lock must be held. */
+struct buffer_head *
+bc_select_victim (void)
+{
+  struct buffer_head *victim = NULL;
+  unsigned int i;
+
+  ASSERT (lock_held_by_current_thread (&bc_lock));
 
-  /* If buffer cache is full, find victim. */
-  while (buffer_head [clock_hand].clock_bit == true &&
-         buffer_head [clock_hand].victim == false)
+  while (victim == NULL)
   {
-    buffer_head [clock_hand].clock_bit = false;
-    clock_hand++;
-    if (clock_hand == BUFFER_CACHE_ENTRY_NB)
-      clock_hand = 0;
+    /* If empty cache is exist, then return. */
+    for (i = 0; i < BUFFER_CACHE_ENTRY_NB && victim == NULL; i++)
+      if (!buffer_head [i].valid && !buffer_head [i].busy)
+        victim = &buffer_head [i];
+
+    /* If buffer cache is full, find victim.  Two turns of the
+       clock clear every clock_bit. */
+    for (i = 0; i < 2 * BUFFER_CACHE_ENTRY_NB && victim == NULL; i++)
+    {
+      struct buffer_head *b = &buffer_head [clock_hand];
+
+      clock_hand++;
+      if (clock_hand == BUFFER_CACHE_ENTRY_NB)
+        clock_hand = 0;
+      if (b->busy)
+        continue;
+      if (b->clock_bit)
+        b->clock_bit = false;
+      else
+        victim = b;
+    }
+
+    if (victim == NULL)
+      cond_wait (&bc_busy_cond, &bc_lock);
   }
 
-  /* Selected as a victim. */
-  buffer_head [clock_hand].victim = true;
-  lock_acquire (&buffer_head [clock_hand].head_lock);
-  /* If selected victim entry is dirty, flush.*/
-  if (buffer_head [clock_hand].dirty == true &&
-      buffer_head [clock_hand].valid == true)
-    bc_flush_entry (&buffer_head [clock_hand]);
-  /* Update buffer_head of victim entry. */
-  buffer_head [clock_hand].dirty = false;
-  buffer_head [clock_hand].clock_bit = false;
-  buffer_head [clock_hand].sector = 0;
-  buffer_head [clock_hand].valid = false;
-  buffer_head [clock_hand].victim = false;
-  lock_release (&buffer_head [clock_hand].head_lock);
-
-  /* Return victim entry. */
-  return &buffer_head [clock_hand];
+  victim->busy = true;
+  return victim;
 }
 
 /* Traverse buffer_head and check disk block is cached or not. 
    If cached, return buffer cache entry. 
-   If not, return NULL. */
+   If not, return NULL.  bc_lock must be held. */
 struct buffer_head *
 bc_lookup (block_sector_t sector)
 {
@@ -164,8 +215,7 @@ bc_lookup (block_sector_t sector)
   for (i = 0; i < BUFFER_CACHE_ENTRY_NB; i++)
   {
     if (buffer_head [i].valid == true && 
-        buffer_head [i].sector == sector &&
-        buffer_head [i].victim == false)
+        buffer_head [i].sector == sector)
     {
       success = true;
       break;
@@ -181,6 +231,8 @@ bc_lookup (block_sector_t sector)
 void 
 bc_flush_entry (struct buffer_head *buffer_head)
 {
+  ASSERT (rwlock_held_for_write (&buffer_head->head_lock));
+
   /* Call block_write, flush buffer cache entry data to disk. */
   block_write (fs_device, buffer_head->sector, buffer_head->data);
   /* Update buffer_head's dirty bit. */
@@ -196,8 +248,10 @@ bc_flush_all_entries (void)
   unsigned int i = 0;
   for (i = 0; i < BUFFER_CACHE_ENTRY_NB; i ++)
   {
+    rwlock_acquire_write (&buffer_head [i].head_lock);
     if (buffer_head [i].valid == true &&
         buffer_head [i].dirty == true)
       bc_flush_entry (&buffer_head [i]);      /* Flush. */
+    rwlock_release_write (&buffer_head [i].head_lock);
   }
 }
@@ -14,9 +14,10 @@ struct buffer_head
   bool dirty;               /* Flag shows dirty. */
   bool clock_bit;           /* True : accessed recently. False : not. */
   bool valid;               /* True : valid entry. False : not. */
-  bool victim;              /* True : selected as victim, False: not. */
+  bool busy;                /* Claimed as a victim by bc_get (). */
   block_sector_t sector;    /* Address of disk sector of it's entry. */
-  struct lock head_lock;    /* Lock. */
+  struct rwlock head_lock;  /* Held for reading to copy data out,
+                               for writing to change it. */
   void *data;               /* Buffer cache entry data pointer. */
 };
 
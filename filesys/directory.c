@@ -5,6 +5,7 @@
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 
 /* A directory. */
@@ -115,20 +116,25 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Lookups in one directory run in parallel. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  struct rwlock *dir_lock;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  dir_lock = inode_get_dir_lock (dir->inode);
+  rwlock_acquire_read (dir_lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  rwlock_release_read (dir_lock);
 
   return *inode != NULL;
 }
@@ -142,6 +148,7 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct rwlock *dir_lock;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -153,7 +160,10 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
+  /* Check that NAME is not in use.  Holding the directory for
+     writing keeps the name free until the entry is written. */
+  dir_lock = inode_get_dir_lock (dir->inode);
+  rwlock_acquire_write (dir_lock);
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
@@ -176,6 +186,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  rwlock_release_write (dir_lock);
   return success;
 }
 
@@ -185,6 +196,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct rwlock *dir_lock;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -197,6 +209,9 @@ dir_remove (struct dir *dir, const char *name)
   if (!strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
+  dir_lock = inode_get_dir_lock (dir->inode);
+  rwlock_acquire_write (dir_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -216,6 +231,7 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  rwlock_release_write (dir_lock);
   inode_close (inode);
   return success;
 }
@@ -226,18 +242,23 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct rwlock *dir_lock = inode_get_dir_lock (dir->inode);
   struct dir_entry e;
+  bool success = false;
 
+  rwlock_acquire_read (dir_lock);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  rwlock_release_read (dir_lock);
+  return success;
 }
 
 bool
@@ -8,6 +8,7 @@
 struct file;
 
 /* Opening and closing files. */
+void file_init (void);
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
 void file_close (struct file *);
@@ -18,6 +19,8 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_try_write_at (struct file *, const void *, off_t size,
+                         off_t start);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
@@ -11,8 +11,39 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Locking.  There is no global file system lock; each structure
+   has its own, and a thread holding several takes them in this
+   order:
+
+     1. lru_list_lock (vm/frame.c).
+     2. A directory's dir_lock (directory.c).
+     3. A file's data_lock (inode.c).
+     4. free_map_lock (free-map.c).
+     5. The free map file's data_lock.
+     6. A buffer's head_lock, then bc_lock (buffer_cache.c).
+
+   open_inodes_lock (inode.c) is a leaf: nothing else is taken
+   while it is held, not even by malloc () or free ().
+
+   Eviction writes file pages back, waiting for the file's
+   data_lock, so a thread must not fault or allocate a user frame
+   while it holds a file system lock.  System calls pin their user
+   buffers beforehand for that reason, and alloc_page () and
+   pin_vme () check filesys_lock_held (). */
+
 static void do_format (void);
 
+/* Returns true if the current thread holds a file system lock
+   that eviction might wait for.  The inode and buffer locks are
+   the only readers-writer locks in the kernel; the other file
+   system locks are never held outside the file system, which
+   does not fault. */
+bool
+filesys_lock_held (void)
+{
+  return thread_current ()->rwlock_cnt > 0;
+}
+
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
@@ -32,6 +63,7 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  file_init ();
   free_map_init ();
 
   if (format) 
@@ -17,6 +17,7 @@ void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_lock_held (void);
 
 struct dir *parse_path (char *path_name, char *file_name);
 bool filesys_create_dir (const char *name);
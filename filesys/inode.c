@@ -63,7 +63,8 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.  open_cnt, removed and deny_write_cnt are
+   protected by open_inodes_lock. */
 struct inode 
   {
     struct list_elem elem;              /* Element in inode list. */
@@ -71,7 +72,10 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct lock extend_lock;            /* Lock when aceessing inode. */
+    struct rwlock data_lock;            /* Shared by readers of the data,
+                                           exclusive to writers. */
+    struct rwlock dir_lock;             /* Directory entries, see
+                                           inode_get_dir_lock (). */
   };
 
 static bool get_disk_inode (const struct inode *, struct inode_disk *);
@@ -82,6 +86,9 @@ static bool register_sector (struct inode_disk *, block_sector_t,
 bool inode_update_file_length (struct inode_disk *, off_t, off_t);
 block_sector_t alloc_indirect_index_block (void);
 static void free_inode_sectors (struct inode_disk *);
+static off_t write_at (struct inode *, const void *, off_t size,
+                       off_t offset, bool wait);
+static struct inode *find_open_inode (block_sector_t sector);
 
 /* Modified codes for extensible file. */
 /* Return disk block number using file offset. */
@@ -155,11 +162,17 @@ byte_to_sector (const struct inode_disk *inode_disk, off_t pos)
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Protects open_inodes and the open counts of its inodes.  No
+   other lock is acquired while holding it, so memory is allocated
+   and freed outside of it. */
+static struct lock open_inodes_lock;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -205,26 +218,33 @@ inode_create (block_sector_t sector, off_t length, uint32_t is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
+  struct inode *new_inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-  {
-    inode = list_entry (e, struct inode, elem);
-    if (inode->sector == sector) 
-    {
-      inode_reopen (inode);
-      return inode; 
-    }
-  }
+  lock_acquire (&open_inodes_lock);
+  inode = find_open_inode (sector);
+  lock_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
+  /* Allocate memory.  malloc () takes locks of its own, so this is
+     done without open_inodes_lock and the list checked again. */
+  new_inode = malloc (sizeof *new_inode);
+  if (new_inode == NULL)
     return NULL;
 
+  lock_acquire (&open_inodes_lock);
+  inode = find_open_inode (sector);
+  if (inode != NULL)
+  {
+    /* Somebody else opened it meanwhile. */
+    lock_release (&open_inodes_lock);
+    free (new_inode);
+    return inode;
+  }
+  inode = new_inode;
+
   /* Initialize. */
   list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
@@ -233,20 +253,58 @@ inode_open (block_sector_t sector)
   inode->removed = false;
 
   /* Fixed code for extensible file. */
-  lock_init (&inode->extend_lock);
+  rwlock_init (&inode->data_lock);
+  rwlock_init (&inode->dir_lock);
   //block_read (fs_device, inode->sector, &inode->data);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
+/* Returns the open inode of SECTOR with its open count raised, or
+   a null pointer if SECTOR is not open.  open_inodes_lock must be
+   held. */
+static struct inode *
+find_open_inode (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+       e = list_next (e))
+  {
+    struct inode *inode = list_entry (e, struct inode, elem);
+    if (inode->sector == sector)
+    {
+      inode->open_cnt++;
+      return inode;
+    }
+  }
+  return NULL;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
+  {
+    lock_acquire (&open_inodes_lock);
     inode->open_cnt++;
+    lock_release (&open_inodes_lock);
+  }
   return inode;
 }
 
+/* Returns the lock of the directory entries stored in INODE.
+   Directory code holds it across a whole lookup or update, and
+   may read and write INODE while holding it. */
+struct rwlock *
+inode_get_dir_lock (struct inode *inode)
+{
+  return &inode->dir_lock;
+}
+
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
@@ -265,27 +323,33 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          /* Get on-disk inode structrue by get_disk_inode (). */
-          struct inode_disk *disk_inode = (struct inode_disk *) malloc (BLOCK_SECTOR_SIZE);
-          get_disk_inode (inode, disk_inode);
-          /* Deallocate each blocks by free_inode_sectors (). */
-          free_inode_sectors (disk_inode);
-          /* Deallocate on-disk inode by free_map_release (). */
-          free_map_release (inode->sector, 1);
-          /* Deallocate disk_inode. */
-          free (disk_inode);
-        }
+      lock_release (&open_inodes_lock);
+      return;
+    }
+
+  /* Remove from inode list and release lock.  Nobody can find
+     INODE any more, so the rest needs no lock. */
+  list_remove (&inode->elem);
+  lock_release (&open_inodes_lock);
 
-      free (inode); 
+  /* Deallocate blocks if removed. */
+  if (inode->removed) 
+    {
+      /* Get on-disk inode structrue by get_disk_inode (). */
+      struct inode_disk *disk_inode = (struct inode_disk *) malloc (BLOCK_SECTOR_SIZE);
+      get_disk_inode (inode, disk_inode);
+      /* Deallocate each blocks by free_inode_sectors (). */
+      free_inode_sectors (disk_inode);
+      /* Deallocate on-disk inode by free_map_release (). */
+      free_map_release (inode->sector, 1);
+      /* Deallocate disk_inode. */
+      free (disk_inode);
     }
+
+  free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -294,7 +358,9 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -310,6 +376,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   struct inode_disk *inode_disk = malloc (BLOCK_SECTOR_SIZE);
   if (inode_disk == NULL)
     return 0;
+
+  rwlock_acquire_read (&inode->data_lock);
   get_disk_inode (inode, inode_disk);
 
   while (size > 0) 
@@ -335,6 +403,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
+  rwlock_release_read (&inode->data_lock);
 
   free (inode_disk);
   return bytes_read;
@@ -346,8 +415,26 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
    (Normally a write at end of file would extend the inode, but
    growth is not yet implemented.) */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
+{
+  return write_at (inode, buffer, size, offset, true);
+}
+
+/* Like inode_write_at(), but returns -1 without writing instead of
+   waiting if another thread is reading or writing INODE. */
+off_t
+inode_try_write_at (struct inode *inode, const void *buffer, off_t size,
+                    off_t offset)
+{
+  return write_at (inode, buffer, size, offset, false);
+}
+
+/* Writes like inode_write_at().  If WAIT is false, returns -1
+   instead of waiting for INODE's data_lock. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset, bool wait)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
@@ -359,9 +446,16 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   struct inode_disk *inode_disk = malloc (BLOCK_SECTOR_SIZE);
   if (inode_disk == NULL)
     return 0;
+
+  if (wait)
+    rwlock_acquire_write (&inode->data_lock);
+  else if (!rwlock_try_acquire_write (&inode->data_lock))
+    {
+      free (inode_disk);
+      return -1;
+    }
   get_disk_inode (inode, inode_disk);
 
-  lock_acquire (&inode->extend_lock);
   int old_length = inode_disk->length;
   int write_end = offset + size - 1;
 
@@ -374,7 +468,6 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
     bc_write (inode->sector, inode_disk, 0, BLOCK_SECTOR_SIZE, 0);
   }
-  lock_release (&inode->extend_lock);
 
   while (size > 0) 
     {
@@ -402,6 +495,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
   /* Write modified struct disk_inode to buffer cache. */
   bc_write (inode->sector, inode_disk, 0, BLOCK_SECTOR_SIZE, 0);
+  rwlock_release_write (&inode->data_lock);
 
   free (inode_disk);
   return bytes_written;
@@ -412,8 +506,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&open_inodes_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&open_inodes_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -422,9 +518,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&open_inodes_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&open_inodes_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -790,14 +888,21 @@ bool
 inode_is_opened (struct inode *inode)
 {
   struct list_elem *e;
+  bool opened = false;
+
+  lock_acquire (&open_inodes_lock);
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes); e = list_next (e))
   {
     struct inode *cur_inode = list_entry (e, struct inode, elem);
     if (inode == cur_inode)
-      return true;
+    {
+      opened = true;
+      break;
+    }
   }
+  lock_release (&open_inodes_lock);
 
-  return false;
+  return opened;
 }
 
 bool
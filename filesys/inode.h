@@ -7,16 +7,20 @@
 
 struct inode;
 struct bitmap;
+struct rwlock;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t, uint32_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+struct rwlock *inode_get_dir_lock (struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_try_write_at (struct inode *, const void *, off_t size,
+                          off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
@@ -28,7 +28,18 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Memory mapping extensions. */
+    SYS_MSYNC,                  /* Write back a mapped range. */
+    SYS_MADVISE                 /* Give advice about a mapped range. */
   };
 
+/* Advice for madvise(). */
+#define MADV_NORMAL 0           /* Default fault-around. */
+#define MADV_RANDOM 1           /* No fault-around. */
+#define MADV_SEQUENTIAL 2       /* Aggressive read-ahead. */
+#define MADV_WILLNEED 3         /* Bring the range in now. */
+#define MADV_DONTNEED 4         /* Drop the range from memory. */
+
 #endif /* lib/syscall-nr.h */
@@ -2,7 +2,9 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -38,6 +40,10 @@ void close (int fd);
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
 
+/* Memory mapping extensions. */
+int msync (void *addr, size_t length);
+int madvise (void *addr, size_t length, int advice);
+
 /* Project 4 only. */
 bool chdir (const char *dir);
 bool mkdir (const char *dir);
@@ -0,0 +1,52 @@
+/* Child process for syn-bench test.
+   Writes and reads back its own file several times, in blocks,
+   checking what it reads. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-bench.h"
+
+static char buf[FILE_SIZE];
+static char block[BLOCK_SIZE];
+
+int
+main (int argc, char *argv[])
+{
+  char file_name[16];
+  int child_idx;
+  int pass;
+  int fd;
+  size_t ofs;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (file_name, sizeof file_name, "bench-%d", child_idx);
+
+  for (ofs = 0; ofs < sizeof buf; ofs++)
+    buf[ofs] = ofs * 7 + child_idx;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      seek (fd, 0);
+      for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+        if (write (fd, buf + ofs, BLOCK_SIZE) != BLOCK_SIZE)
+          fail ("write \"%s\" at offset %zu failed", file_name, ofs);
+
+      seek (fd, 0);
+      for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+        {
+          if (read (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+            fail ("read \"%s\" at offset %zu failed", file_name, ofs);
+          compare_bytes (block, buf + ofs, BLOCK_SIZE, ofs, file_name);
+        }
+    }
+  close (fd);
+
+  return child_idx;
+}
@@ -0,0 +1,42 @@
+/* Measures file system throughput as the number of processes
+   grows.  Each child writes and reads back a file of its own, so
+   the children share no file and only contend for the file
+   system's own locks.  With fine-grained locking the cost per
+   kilobyte should not grow much with more processes.  Cycles are
+   counted with the time-stamp counter. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/base/syn-bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const int child_cnts[] = { 1, 2, 4 };
+
+void
+test_main (void)
+{
+  pid_t children[FILE_CNT];
+  size_t i;
+  int j;
+
+  for (j = 0; j < FILE_CNT; j++)
+    {
+      char file_name[16];
+
+      snprintf (file_name, sizeof file_name, "bench-%d", j);
+      CHECK (create (file_name, FILE_SIZE), "create \"%s\"", file_name);
+    }
+
+  for (i = 0; i < sizeof child_cnts / sizeof *child_cnts; i++)
+    {
+      int cnt = child_cnts[i];
+      uint64_t start = rdtsc ();
+      uint64_t kb = (uint64_t) cnt * PASS_CNT * FILE_SIZE * 2 / 1024;
+
+      exec_children ("child-syn-bench", children, cnt);
+      wait_children (children, cnt);
+      msg ("%d processes: %"PRIu64" cycles/KB", cnt, (rdtsc () - start) / kb);
+    }
+}
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_bench ('syn-bench',
+  qr/^\(syn-bench\) \d+ processes: \d+ cycles\/KB$/, 3);
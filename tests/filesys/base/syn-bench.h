@@ -0,0 +1,9 @@
+#ifndef TESTS_FILESYS_BASE_SYN_BENCH_H
+#define TESTS_FILESYS_BASE_SYN_BENCH_H
+
+#define FILE_CNT 4
+#define FILE_SIZE (24 * 1024)
+#define PASS_CNT 4
+#define BLOCK_SIZE 512
+
+#endif /* tests/filesys/base/syn-bench.h */
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <syscall.h>
 
 extern const char *test_name;
@@ -35,6 +36,15 @@ void fail (const char *, ...) PRINTF_FORMAT (1, 2) NO_RETURN;
           }                                     \
         while (0)
 
+/* Returns the CPU's time-stamp counter, for benchmarks. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 void shuffle (void *, size_t cnt, size_t size);
 
 void exec_children (const char *child_name, pid_t pids[], size_t child_cnt);
@@ -152,6 +152,26 @@ sub get_core_output {
     return @output[$start...$end];
 }
 
+# Checks the output of benchmark $name: it must run cleanly, print
+# exactly $count lines matching $regex, and reach its end message.
+# The timings themselves vary from machine to machine and are not
+# checked.
+sub check_bench {
+    my ($name, $regex, $count) = @_;
+    my (@output) = read_text_file ("$test.output");
+
+    common_checks ("run", @output);
+
+    @output = get_core_output ("run", @output);
+    my (@results) = grep (/$regex/, @output);
+    fail "expected $count measurement(s), got " . scalar (@results) . "\n"
+      if @results != $count;
+    fail "missing end in output"
+      unless grep ($_ eq "($name) end", @output);
+
+    pass;
+}
+
 sub compare_output {
     my ($run) = shift @_;
     my ($expected) = pop @_;
@@ -0,0 +1,154 @@
+/* Runs several threads that malloc(), realloc() and free()
+   blocks of random sizes, from 1 byte to beyond the largest
+   size class, while being preempted by each other.  Each block
+   is filled with a pattern that identifies it, and the pattern
+   is checked before the block is resized or freed, so blocks
+   handed out twice or overlapping are caught. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 4
+#define ITER_CNT 2000
+#define SLOT_CNT 32
+
+/* A live block. */
+struct slot
+  {
+    uint8_t *p;                 /* Block, or null. */
+    size_t size;                /* Bytes filled with PATTERN. */
+    uint8_t pattern;            /* Fill byte. */
+  };
+
+struct stress_data
+  {
+    int id;                     /* Thread number. */
+    unsigned seed;              /* Random number state. */
+    struct semaphore *done;     /* Upped when finished. */
+  };
+
+static thread_func stress_thread;
+
+void
+test_malloc_stress (void) 
+{
+  struct stress_data data[THREAD_CNT];
+  struct semaphore done;
+  int i;
+
+  sema_init (&done, 0);
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "stress %d", i);
+      data[i].id = i;
+      data[i].seed = i * 7919 + 1;
+      data[i].done = &done;
+      thread_create (name, PRI_DEFAULT, stress_thread, &data[i]);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+
+  msg ("%d threads did %d operations each without corruption.",
+       THREAD_CNT, ITER_CNT);
+}
+
+/* Returns a pseudo-random number from *SEED. */
+static unsigned
+next_random (unsigned *seed) 
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 16;
+}
+
+/* Returns a request size: mostly small blocks, some blocks of
+   the multi-page size classes and some big blocks. */
+static size_t
+random_size (unsigned *seed) 
+{
+  switch (next_random (seed) % 4)
+    {
+    case 0:
+    case 1:
+      return next_random (seed) % 256 + 1;
+    case 2:
+      return next_random (seed) % 4096 + 1;
+    default:
+      return next_random (seed) % 20000 + 1;
+    }
+}
+
+static void
+fill (struct slot *s) 
+{
+  memset (s->p, s->pattern, s->size);
+}
+
+static void
+check (struct stress_data *d, struct slot *s, size_t size) 
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (s->p[i] != s->pattern)
+      fail ("thread %d: byte %zu of %zu-byte block %p is %02x, not %02x",
+            d->id, i, s->size, s->p, s->p[i], s->pattern);
+}
+
+static void
+stress_thread (void *d_) 
+{
+  struct stress_data *d = d_;
+  struct slot slots[SLOT_CNT];
+  int i;
+
+  memset (slots, 0, sizeof slots);
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      struct slot *s = &slots[next_random (&d->seed) % SLOT_CNT];
+
+      if (s->p == NULL) 
+        {
+          s->size = random_size (&d->seed);
+          s->p = malloc (s->size);
+          if (s->p == NULL)
+            fail ("thread %d: malloc (%zu) failed", d->id, s->size);
+        }
+      else if (next_random (&d->seed) % 2 == 0) 
+        {
+          size_t new_size = random_size (&d->seed);
+          uint8_t *p;
+
+          check (d, s, s->size);
+          p = realloc (s->p, new_size);
+          if (p == NULL)
+            fail ("thread %d: realloc (%zu) failed", d->id, new_size);
+          s->p = p;
+          check (d, s, s->size < new_size ? s->size : new_size);
+          s->size = new_size;
+        }
+      else 
+        {
+          check (d, s, s->size);
+          free (s->p);
+          s->p = NULL;
+          continue;
+        }
+
+      s->pattern = d->id * SLOT_CNT + (s - slots) + i;
+      fill (s);
+    }
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (slots[i].p != NULL) 
+      {
+        check (d, &slots[i], slots[i].size);
+        free (slots[i].p);
+      }
+  sema_up (d->done);
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(malloc-stress) begin
+(malloc-stress) 4 threads did 2000 operations each without corruption.
+(malloc-stress) end
+EOF
+pass;
@@ -0,0 +1,205 @@
+/* Donates priority through a chain as deep as the default
+   donation depth, while many threads wait at its tail.
+
+   The main thread, at PRI_MIN, holds chain lock 0.  Chain threads
+   1...CHAIN_CNT each hold chain lock i and wait for lock i - 1,
+   so they form a chain of holders ending at the main thread.
+
+   WAITER_CNT waiters, all of one priority, then each take a lock
+   of their own and wait for the last chain lock.  Finally a donor
+   per waiter, in shuffled order, waits for that waiter's own
+   lock.  This raises waiters at scattered places of the chain
+   lock's queue, and the highest donation must reach the main
+   thread through every holder of the chain.
+
+   When the main thread releases chain lock 0, the chain unwinds
+   at the highest donated priority and the waiters must get the
+   last chain lock in order of donated priority, first come first
+   served among equal priorities. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Chain threads.  With the main thread and a waiter, the donation
+   passes through CHAIN_CNT + 2 holders. */
+#define CHAIN_CNT (DONATE_DEPTH_DEFAULT - 2)
+
+/* Waiters at the tail of the chain, each with its donor. */
+#define WAITER_CNT 24
+
+/* Priority of the waiters, above every chain thread. */
+#define WAITER_PRI (PRI_MIN + CHAIN_CNT + 1)
+
+struct stress
+  {
+    struct lock chain[CHAIN_CNT + 1];   /* Chain locks. */
+    struct lock own[WAITER_CNT];        /* One lock per waiter. */
+    int chain_pri[CHAIN_CNT + 1];       /* Priority of chain threads
+                                           holding their locks. */
+    int order[WAITER_CNT];              /* Waiters, by arrival at
+                                           the last chain lock. */
+    int order_cnt;
+    struct semaphore wake;              /* Wakes the main thread. */
+  };
+
+/* Argument of a chain thread, waiter or donor. */
+struct stress_arg
+  {
+    struct stress *s;
+    int idx;
+  };
+
+static thread_func chain_thread;
+static thread_func waiter_thread;
+static thread_func donor_thread;
+static thread_func waker_thread;
+
+/* Priority donated to waiter IDX. */
+static int
+donor_priority (int idx)
+{
+  return WAITER_PRI + 1 + idx * 7 % 20;
+}
+
+void
+test_priority_donate_stress (void)
+{
+  static struct stress s;
+  struct stress_arg chain_args[CHAIN_CNT + 1];
+  struct stress_arg waiter_args[WAITER_CNT];
+  int expected[WAITER_CNT];
+  int max_pri = PRI_MIN;
+  int i, j;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  thread_set_priority (PRI_MIN);
+  for (i = 0; i <= CHAIN_CNT; i++)
+    lock_init (&s.chain[i]);
+  for (i = 0; i < WAITER_CNT; i++)
+    lock_init (&s.own[i]);
+  sema_init (&s.wake, 0);
+  s.order_cnt = 0;
+
+  lock_acquire (&s.chain[0]);
+  for (i = 1; i <= CHAIN_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "chain %d", i);
+      chain_args[i].s = &s;
+      chain_args[i].idx = i;
+      thread_create (name, PRI_MIN + i, chain_thread, &chain_args[i]);
+    }
+  msg ("Main priority with %d chained holders: %d.",
+       CHAIN_CNT, thread_get_priority ());
+
+  /* Yielding lets each waiter block before the next is created,
+     even though the main thread has the same priority by then. */
+  for (i = 0; i < WAITER_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "waiter %d", i);
+      waiter_args[i].s = &s;
+      waiter_args[i].idx = i;
+      thread_create (name, WAITER_PRI, waiter_thread, &waiter_args[i]);
+      thread_yield ();
+    }
+  msg ("Main priority with %d waiters: %d.",
+       WAITER_CNT, thread_get_priority ());
+
+  /* The donors run, highest first, once the main thread sleeps.
+     The waker runs after all of them have blocked. */
+  thread_set_priority (PRI_MAX);
+  for (i = 0; i < WAITER_CNT; i++)
+    {
+      int idx = (i * 5 + 3) % WAITER_CNT;
+      char name[16];
+
+      snprintf (name, sizeof name, "donor %d", idx);
+      thread_create (name, donor_priority (idx), donor_thread,
+                     &waiter_args[idx]);
+      if (donor_priority (idx) > max_pri)
+        max_pri = donor_priority (idx);
+    }
+  thread_create ("waker", WAITER_PRI, waker_thread, &s);
+  sema_down (&s.wake);
+  thread_set_priority (PRI_MIN);
+  msg ("Main priority with %d donors: %d.",
+       WAITER_CNT, thread_get_priority ());
+
+  lock_release (&s.chain[0]);
+
+  for (i = 1; i <= CHAIN_CNT; i++)
+    if (s.chain_pri[i] != max_pri)
+      fail ("chain %d held its lock at priority %d, expected %d.",
+            i, s.chain_pri[i], max_pri);
+  msg ("Chain holders ran at priority %d.", max_pri);
+
+  /* Waiters by descending donated priority, stable. */
+  for (i = 0; i < WAITER_CNT; i++)
+    {
+      for (j = i; j > 0
+                  && donor_priority (expected[j - 1]) < donor_priority (i);
+           j--)
+        expected[j] = expected[j - 1];
+      expected[j] = i;
+    }
+  if (s.order_cnt != WAITER_CNT)
+    fail ("%d waiters got the lock, expected %d.", s.order_cnt, WAITER_CNT);
+  for (i = 0; i < WAITER_CNT; i++)
+    if (s.order[i] != expected[i])
+      fail ("waiter %d got the lock in position %d, expected waiter %d.",
+            s.order[i], i, expected[i]);
+  msg ("Waiters got the lock in priority order.");
+}
+
+static void
+chain_thread (void *arg_)
+{
+  struct stress_arg *arg = arg_;
+  struct stress *s = arg->s;
+  int i = arg->idx;
+
+  lock_acquire (&s->chain[i]);
+  lock_acquire (&s->chain[i - 1]);
+  s->chain_pri[i] = thread_get_priority ();
+  lock_release (&s->chain[i - 1]);
+  lock_release (&s->chain[i]);
+}
+
+static void
+waiter_thread (void *arg_)
+{
+  struct stress_arg *arg = arg_;
+  struct stress *s = arg->s;
+
+  lock_acquire (&s->own[arg->idx]);
+  lock_acquire (&s->chain[CHAIN_CNT]);
+  s->order[s->order_cnt++] = arg->idx;
+  lock_release (&s->chain[CHAIN_CNT]);
+  lock_release (&s->own[arg->idx]);
+}
+
+static void
+donor_thread (void *arg_)
+{
+  struct stress_arg *arg = arg_;
+  struct stress *s = arg->s;
+
+  lock_acquire (&s->own[arg->idx]);
+  lock_release (&s->own[arg->idx]);
+}
+
+static void
+waker_thread (void *s_)
+{
+  struct stress *s = s_;
+
+  sema_up (&s->wake);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(priority-donate-stress) begin
+(priority-donate-stress) Main priority with 6 chained holders: 6.
+(priority-donate-stress) Main priority with 24 waiters: 7.
+(priority-donate-stress) Main priority with 24 donors: 27.
+(priority-donate-stress) Chain holders ran at priority 27.
+(priority-donate-stress) Waiters got the lock in priority order.
+(priority-donate-stress) end
+EOF
+pass;
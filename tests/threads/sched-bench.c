@@ -0,0 +1,79 @@
+/* Measures the cost of scheduling with hundreds of runnable
+   threads.  Each thread repeatedly moves itself to a random
+   priority below the main thread's and yields, so every
+   iteration inserts into and picks from a run queue holding
+   all of them.  Reports cycles per iteration, counted with the
+   time-stamp counter. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 200
+#define ITER_CNT 100
+
+struct bench_data
+  {
+    unsigned seed;              /* Random number state. */
+    struct semaphore *done;     /* Upped when finished. */
+  };
+
+static thread_func bench_thread;
+
+void
+test_sched_bench (void) 
+{
+  struct bench_data *data;
+  struct semaphore done;
+  uint64_t start, cycles;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  data = malloc (sizeof *data * THREAD_CNT);
+  ASSERT (data != NULL);
+  sema_init (&done, 0);
+
+  /* The threads have lower priority than us, so none of them
+     runs until we block below. */
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "bench %d", i);
+      data[i].seed = i + 1;
+      data[i].done = &done;
+      thread_create (name, PRI_MIN + 1 + i % (PRI_DEFAULT - 1),
+                     bench_thread, &data[i]);
+    }
+
+  start = rdtsc ();
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  cycles = rdtsc () - start;
+
+  msg ("%d threads yielded %d times each: %llu cycles per yield",
+       THREAD_CNT, ITER_CNT,
+       (unsigned long long) (cycles / (THREAD_CNT * ITER_CNT)));
+  free (data);
+}
+
+static void
+bench_thread (void *data_) 
+{
+  struct bench_data *data = data_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      data->seed = data->seed * 1103515245 + 12345;
+      thread_set_priority (PRI_MIN + 1
+                           + (data->seed >> 16) % (PRI_DEFAULT - 1));
+      thread_yield ();
+    }
+  sema_up (data->done);
+}
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_bench ('sched-bench',
+  qr/^\(sched-bench\) \d+ threads yielded \d+ times each: \d+ cycles per yield$/, 1);
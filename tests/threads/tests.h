@@ -1,6 +1,8 @@
 #ifndef TESTS_THREADS_TESTS_H
 #define TESTS_THREADS_TESTS_H
 
+#include <stdint.h>
+
 void run_test (const char *);
 
 typedef void test_func (void);
@@ -19,6 +21,7 @@ extern test_func test_priority_donate_sema;
 extern test_func test_priority_donate_nest;
 extern test_func test_priority_donate_lower;
 extern test_func test_priority_donate_chain;
+extern test_func test_priority_donate_stress;
 extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
@@ -32,10 +35,21 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_malloc_stress;
+extern test_func test_sched_bench;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
 void pass (void);
 
+/* Returns the CPU's time-stamp counter, for benchmarks. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 #endif /* tests/threads/tests.h */
 
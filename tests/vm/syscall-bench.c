@@ -0,0 +1,56 @@
+/* Measures read and write system call throughput against buffer
+   size.  Every buffer size moves the same number of bytes through
+   a file, so a per-byte cost in user buffer validation shows up
+   as cycles per kilobyte that do not shrink with larger buffers.
+   Cycles are counted with the time-stamp counter. */
+
+#include <inttypes.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TOTAL (64 * 1024)
+
+static char buf[TOTAL];
+
+static const size_t sizes[] = { 64, 512, 4096, 16384, 65536 };
+
+static void
+report (const char *op, size_t size, uint64_t cycles)
+{
+  msg ("%s with %zu-byte buffers: %"PRIu64" cycles/KB",
+       op, size, cycles / (TOTAL / 1024));
+}
+
+void
+test_main (void)
+{
+  size_t i;
+  int fd;
+
+  CHECK (create ("bench", TOTAL), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      size_t size = sizes[i];
+      size_t ofs;
+      uint64_t start;
+
+      seek (fd, 0);
+      start = rdtsc ();
+      for (ofs = 0; ofs < TOTAL; ofs += size)
+        if (write (fd, buf + ofs, size) != (int) size)
+          fail ("write of %zu bytes at offset %zu failed", size, ofs);
+      report ("write", size, rdtsc () - start);
+
+      seek (fd, 0);
+      start = rdtsc ();
+      for (ofs = 0; ofs < TOTAL; ofs += size)
+        if (read (fd, buf + ofs, size) != (int) size)
+          fail ("read of %zu bytes at offset %zu failed", size, ofs);
+      report ("read", size, rdtsc () - start);
+    }
+
+  close (fd);
+}
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_bench ('syscall-bench',
+  qr/^\(syscall-bench\) (read|write) with \d+-byte buffers: \d+ cycles\/KB$/, 10);
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_bench ('tlb-bench',
+  qr/^\(tlb-bench\) (row|column) walk: \d+ cycles per 1000 elements$/, 2);
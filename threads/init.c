@@ -38,11 +38,15 @@
 #include "filesys/fsutil.h"
 #endif
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #include "vm/frame.h"
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+#define CR4_PSE 0x00000010      /* Page Size Extensions (4 MB pages). */
+#define CPUID_PSE 0x00000008    /* CPUID.1:EDX bit for PSE support. */
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -59,8 +63,18 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -no-pse: Map the kernel with 4 kB pages only. */
+static bool no_pse;
+
+/* True if the CPU supports 4 MB pages and CR4.PSE is set. */
+bool pse_enabled;
+
+/* -large-pages: Back big zero-filled user regions with 4 MB pages. */
+bool large_user_pages;
+
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -130,8 +144,10 @@ main (void)
 #endif
 
   /* Added codes for VM. */
+  vme_cache_init ();
   lru_list_init ();
   swap_init ();
+  kswapd_init ();
 
   printf ("Boot complete.\n");
   
@@ -164,9 +180,22 @@ static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
-  size_t page;
+  size_t page, large_cnt = 0;
   extern char _start, _end_kernel_text;
 
+  /* 4 MB pages must be enabled before CR3 points to a page
+     directory that uses them.  See [IA32-v3a] 2.5 "Control
+     Registers". */
+  if (!no_pse && cpu_has_pse ())
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
+      pse_enabled = true;
+    }
+  else
+    large_user_pages = false;
+
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
   for (page = 0; page < init_ram_pages; page++)
@@ -177,6 +206,19 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      /* A whole 4 MB of RAM without kernel code in it takes one
+         writable large page instead of a page table.  The code
+         keeps its read-only 4 kB pages. */
+      if (pse_enabled && pte_idx == 0
+          && page + LARGE_PGPAGES <= init_ram_pages
+          && (vaddr + LARGE_PGSIZE <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true, false);
+          page += LARGE_PGPAGES - 1;
+          large_cnt++;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -186,6 +228,9 @@ paging_init (void)
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
     }
 
+  if (large_cnt > 0)
+    printf ("Mapped %zu MB of RAM with 4 MB pages.\n", large_cnt * 4);
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -194,6 +239,17 @@ paging_init (void)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns true if the CPU supports 4 MB pages, as reported by
+   CPUID function 1.  See [IA32-v2a] "CPUID--CPU Identification". */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & CPUID_PSE) != 0;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -256,16 +312,42 @@ parse_options (char **argv)
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-swap-pri"))
+        {
+          char *bdev = strtok_r (value, ":", &save_ptr);
+          char *pri = strtok_r (NULL, "", &save_ptr);
+          if (bdev == NULL || pri == NULL)
+            PANIC ("-swap-pri requires BDEV:PRI");
+          swap_set_priority (bdev, atoi (pri));
+        }
+      else if (!strcmp (name, "-zswap"))
+        zswap_set_limit (atoi (value));
+      else if (!strcmp (name, "-rss-limit"))
+        frame_set_rss_limit (atoi (value));
+      else if (!strcmp (name, "-vmstats"))
+        frame_enable_process_stats ();
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-donate-depth"))
+        thread_donate_depth = atoi (value);
+#ifdef LOCK_STATS
+      else if (!strcmp (name, "-lock-stats"))
+        lock_stats_top = atoi (value);
+#endif
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-large-pages"))
+        large_user_pages = true;
 #endif
+      else if (!strcmp (name, "-no-pse"))
+        no_pse = true;
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
     }
@@ -381,12 +463,23 @@ usage (void)
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -swap-pri=BDEV:PRI Use swap device BDEV with priority PRI.\n"
+          "  -zswap=PAGES       Keep up to PAGES of compressed swap in RAM.\n"
+          "  -rss-limit=PAGES   Evict first from processes above PAGES frames.\n"
+          "  -vmstats           Print RSS and page faults of each process.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer tick while idle.\n"
+          "  -donate-depth=N    Pass priority donations along N lock holders.\n"
+#ifdef LOCK_STATS
+          "  -lock-stats=N      Print the N most contended locks at shutdown.\n"
+#endif
+          "  -no-pse            Do not use 4 MB pages for kernel memory.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -large-pages       Use 4 MB pages for large zeroed user regions.\n"
 #endif
           );
   shutdown_power_off ();
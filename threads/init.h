@@ -9,4 +9,8 @@
 /* Page directory with kernel mappings only. */
 extern uint32_t *init_page_dir;
 
+/* 4 MB page support.  See paging_init(). */
+extern bool pse_enabled;
+extern bool large_user_pages;
+
 #endif /* threads/init.h */
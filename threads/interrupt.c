@@ -206,6 +206,31 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Returns true if external interrupt VEC_NO has been raised but
+   not yet delivered to the CPU. */
+bool
+intr_ext_pending (uint8_t vec_no)
+{
+  int irq = vec_no - 0x20;
+  uint8_t irr;
+
+  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+
+  /* OCW3: read the interrupt request register. */
+  if (irq < 8)
+    {
+      outb (PIC0_CTRL, 0x0a);
+      irr = inb (PIC0_CTRL);
+    }
+  else
+    {
+      outb (PIC1_CTRL, 0x0a);
+      irr = inb (PIC1_CTRL);
+      irq -= 8;
+    }
+  return (irr >> irq) & 1;
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -28,19 +29,50 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   Blocks of 1 kB and up would waste much of a one-page arena,
+   so their arenas span several contiguous pages, as many as it
+   takes to lose at most 1/8 of the arena.  Size classes between
+   powers of 2 (1.5 kB, 3 kB, ...) bound the rounding loss of
+   these larger blocks.  The arena of a block that does not lie
+   in the arena's first page is found through arena_map.
+
+   Each descriptor has a small "magazine" of free blocks in front
+   of its free list.  Pintos runs on one CPU, so the magazine is
+   guarded by disabling interrupts for a few instructions rather
+   than by the descriptor's lock, and most malloc()/free() pairs
+   never touch the lock.  Blocks in a magazine still count as
+   in use by their arena.
+
+   We can't handle blocks bigger than the largest size class
+   using this scheme.  We handle those by allocating contiguous
+   pages with the page allocator and sticking the allocation
+   size at the beginning of the allocated block's arena header. */
+
+/* Blocks cached in a descriptor's magazine. */
+#define MAG_SIZE 16
+
+/* Most pages in an arena. */
+#define ARENA_MAX_PAGES 16
 
 /* Descriptor. */
 struct desc
   {
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    size_t arena_pages;         /* Number of pages in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+
+    /* Magazine, accessed with interrupts off. */
+    void *mag[MAG_SIZE];        /* Cached free blocks. */
+    size_t mag_cnt;             /* Blocks in MAG. */
+    size_t mag_cap;             /* Most blocks MAG may hold. */
+
+    /* Statistics, updated with interrupts off. */
+    size_t arena_cnt;           /* Arenas owned. */
+    size_t in_use;              /* Blocks held by callers. */
+    long long alloc_cnt;        /* Allocations so far. */
+    long long mag_hit_cnt;      /* Allocations served by MAG. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -60,28 +92,102 @@ struct block
     struct list_elem free_elem; /* Free list element. */
   };
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+/* Block sizes of the descriptors, in increasing order. */
+static const size_t class_sizes[] =
+  {
+    16, 32, 64, 128, 256, 512, 1024, 1536,
+    2048, 3072, 4096, 6144, 8192, 12288, 16384,
+  };
 
+/* Our set of descriptors. */
+#define DESC_CNT (sizeof class_sizes / sizeof *class_sizes)
+static struct desc descs[DESC_CNT];   /* Descriptors. */
+static size_t desc_cnt;               /* Number of descriptors. */
+
+/* Arena of each kernel page past the first page of a multi-page
+   arena, indexed by palloc_page_idx(), null for other pages. */
+static struct arena **arena_map;
+
+/* Allocation statistics, updated with interrupts off.  Only
+   allocations that miss the magazines are timed, so the fast path
+   pays for no more than a few increments. */
+static long long slow_cnt, slow_cycles;   /* Not served by a magazine. */
+static long long req_bytes;               /* Bytes requested. */
+static long long got_bytes;               /* Bytes handed out. */
+static size_t big_cnt, big_pages;         /* Live big blocks. */
+
+static size_t arena_pages_for (size_t block_size);
+static void *desc_alloc (struct desc *);
+static void desc_free (struct desc *, struct arena *, struct block *);
+static void *big_alloc (size_t size);
+static void account_alloc (struct desc *, size_t size, size_t got,
+                           uint64_t start);
+static size_t block_size (void *);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
-  size_t block_size;
+  size_t map_size = palloc_page_cnt (0) * sizeof *arena_map;
+  size_t i;
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  for (i = 0; i < DESC_CNT; i++)
     {
       struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+      d->block_size = class_sizes[i];
+      d->arena_pages = arena_pages_for (d->block_size);
+      d->blocks_per_arena = (d->arena_pages * PGSIZE - sizeof (struct arena))
+                            / d->block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      d->mag_cnt = 0;
+      d->mag_cap = d->blocks_per_arena < MAG_SIZE
+                   ? d->blocks_per_arena : MAG_SIZE;
+      d->arena_cnt = d->in_use = 0;
+      d->alloc_cnt = d->mag_hit_cnt = 0;
+    }
+
+  arena_map = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                   DIV_ROUND_UP (map_size, PGSIZE));
+}
+
+/* Returns the number of pages in an arena of BLOCK_SIZE-byte
+   blocks: the fewest that waste at most 1/8 of the arena, or
+   else the count that wastes the least. */
+static size_t
+arena_pages_for (size_t block_size)
+{
+  size_t best = 1, best_waste = PGSIZE;
+  size_t pages;
+
+  for (pages = 1; pages <= ARENA_MAX_PAGES; pages++)
+    {
+      size_t bytes = pages * PGSIZE;
+      size_t blocks = (bytes - sizeof (struct arena)) / block_size;
+      size_t waste = bytes - blocks * block_size;
+
+      if (blocks == 0)
+        continue;
+      if (waste * 8 <= bytes)
+        return pages;
+      if (waste * best < best_waste * pages)
+        {
+          best = pages;
+          best_waste = waste;
+        }
     }
+  return best;
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -90,8 +196,9 @@ void *
 malloc (size_t size) 
 {
   struct desc *d;
-  struct block *b;
-  struct arena *a;
+  void *b = NULL;
+  enum intr_level old_level;
+  uint64_t start;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -104,20 +211,70 @@ malloc (size_t size)
       break;
   if (d == descs + desc_cnt) 
     {
-      /* SIZE is too big for any descriptor.
-         Allocate enough pages to hold SIZE plus an arena. */
-      size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
-      if (a == NULL)
-        return NULL;
-
-      /* Initialize the arena to indicate a big block of PAGE_CNT
-         pages, and return it. */
-      a->magic = ARENA_MAGIC;
-      a->desc = NULL;
-      a->free_cnt = page_cnt;
-      return a + 1;
+      /* SIZE is too big for any descriptor. */
+      start = rdtsc ();
+      b = big_alloc (size);
+      if (b != NULL)
+        account_alloc (NULL, size, block_size (b), start);
+      return b;
+    }
+
+  /* Try the magazine first, accounting for a hit while
+     interrupts are still off. */
+  old_level = intr_disable ();
+  if (d->mag_cnt > 0)
+    {
+      b = d->mag[--d->mag_cnt];
+      d->in_use++;
+      d->alloc_cnt++;
+      d->mag_hit_cnt++;
+      req_bytes += size;
+      got_bytes += d->block_size;
     }
+  intr_set_level (old_level);
+  if (b != NULL)
+    return b;
+
+  start = rdtsc ();
+  b = desc_alloc (d);
+  if (b != NULL)
+    account_alloc (d, size, d->block_size, start);
+  return b;
+}
+
+/* Allocates SIZE bytes as a big block of contiguous pages. */
+static void *
+big_alloc (size_t size)
+{
+  /* Allocate enough pages to hold SIZE plus an arena. */
+  size_t page_cnt = DIV_ROUND_UP (size + sizeof (struct arena), PGSIZE);
+  struct arena *a = palloc_get_multiple (0, page_cnt);
+  enum intr_level old_level;
+
+  if (a == NULL)
+    return NULL;
+
+  /* Initialize the arena to indicate a big block of PAGE_CNT
+     pages, and return it. */
+  a->magic = ARENA_MAGIC;
+  a->desc = NULL;
+  a->free_cnt = page_cnt;
+
+  old_level = intr_disable ();
+  big_cnt++;
+  big_pages += page_cnt;
+  intr_set_level (old_level);
+  return a + 1;
+}
+
+/* Takes a block from D's free list, creating a new arena if the
+   list is empty.  Returns a null pointer if memory is not
+   available. */
+static void *
+desc_alloc (struct desc *d)
+{
+  struct block *b;
+  struct arena *a;
 
   lock_acquire (&d->lock);
 
@@ -126,8 +283,8 @@ malloc (size_t size)
     {
       size_t i;
 
-      /* Allocate a page. */
-      a = palloc_get_page (0);
+      /* Allocate the arena's pages. */
+      a = palloc_get_multiple (0, d->arena_pages);
       if (a == NULL) 
         {
           lock_release (&d->lock);
@@ -138,11 +295,14 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
+      for (i = 1; i < d->arena_pages; i++)
+        arena_map[palloc_page_idx (0, (uint8_t *) a + i * PGSIZE)] = a;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
           list_push_back (&d->free_list, &b->free_elem);
         }
+      d->arena_cnt++;
     }
 
   /* Get a block from free list and return it. */
@@ -153,6 +313,27 @@ malloc (size_t size)
   return b;
 }
 
+/* Records an allocation of GOT bytes from D, null for a big
+   block, for a SIZE-byte request that missed the magazines at
+   time-stamp START. */
+static void
+account_alloc (struct desc *d, size_t size, size_t got, uint64_t start)
+{
+  long long cycles = rdtsc () - start;
+  enum intr_level old_level = intr_disable ();
+
+  slow_cnt++;
+  slow_cycles += cycles;
+  req_bytes += size;
+  got_bytes += got;
+  if (d != NULL)
+    {
+      d->in_use++;
+      d->alloc_cnt++;
+    }
+  intr_set_level (old_level);
+}
+
 /* Allocates and return A times B bytes initialized to zeroes.
    Returns a null pointer if memory is not available. */
 void *
@@ -223,51 +404,111 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
+      enum intr_level old_level;
       
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          bool cached;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
 
-          lock_release (&d->lock);
+          /* Put it in the magazine if there is room. */
+          old_level = intr_disable ();
+          d->in_use--;
+          cached = d->mag_cnt < d->mag_cap;
+          if (cached)
+            d->mag[d->mag_cnt++] = b;
+          intr_set_level (old_level);
+
+          if (!cached)
+            desc_free (d, a, b);
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          old_level = intr_disable ();
+          big_cnt--;
+          big_pages -= a->free_cnt;
+          intr_set_level (old_level);
           palloc_free_multiple (a, a->free_cnt);
-          return;
         }
     }
 }
+
+/* Returns block B of arena A to D's free list, freeing A if
+   none of its blocks is in use any more. */
+static void
+desc_free (struct desc *d, struct arena *a, struct block *b)
+{
+  lock_acquire (&d->lock);
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      for (i = 1; i < d->arena_pages; i++)
+        arena_map[palloc_page_idx (0, (uint8_t *) a + i * PGSIZE)] = NULL;
+      a->magic = 0;
+      palloc_free_multiple (a, d->arena_pages);
+      d->arena_cnt--;
+    }
+
+  lock_release (&d->lock);
+}
+
+/* Prints, for each size class in use, its arenas and blocks,
+   then the average cost of an allocation that missed the
+   magazines and the bytes lost to rounding requests up to a size
+   class. */
+void
+malloc_print_stats (void)
+{
+  size_t free_bytes = 0;
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->alloc_cnt > 0)
+      {
+        size_t free_cnt = d->arena_cnt * d->blocks_per_arena - d->in_use;
+        printf ("Malloc %5zu: %zu arenas of %zu pages, %zu blocks in use, "
+                "%zu free, %lld allocations, %lld from magazine\n",
+                d->block_size, d->arena_cnt, d->arena_pages, d->in_use,
+                free_cnt, d->alloc_cnt, d->mag_hit_cnt);
+        free_bytes += free_cnt * d->block_size;
+      }
+  printf ("Malloc: %zu big blocks in %zu pages, %zu bytes free in arenas\n",
+          big_cnt, big_pages, free_bytes);
+  printf ("Malloc: %lld cycles per allocation missing the magazines, "
+          "%lld of %lld bytes lost to rounding\n",
+          slow_cnt > 0 ? slow_cycles / slow_cnt : 0,
+          got_bytes - req_bytes, got_bytes);
+}
 
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
 {
-  struct arena *a = pg_round_down (b);
+  size_t idx = palloc_page_idx (0, b);
+  struct arena *a = NULL;
+
+  if (idx != SIZE_MAX)
+    a = arena_map[idx];
+  if (a == NULL)
+    a = pg_round_down (b);
 
   /* Check that the arena is valid. */
   ASSERT (a != NULL);
@@ -275,7 +516,8 @@ block_to_arena (struct block *b)
 
   /* Check that the block is properly aligned for the arena. */
   ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
+          || ((uint8_t *) b - (uint8_t *) (a + 1))
+             % a->desc->block_size == 0);
   ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
 
   return a;
@@ -2,13 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -25,12 +26,54 @@
    half to the user pool.  That should be huge overkill for the
    kernel pool, but that's just fine for demonstration purposes. */
 
+/* Each pool hands out pages with a binary buddy allocator.
+   The free pages of a pool are kept as blocks of 2**ORDER pages
+   whose first frame number is a multiple of 2**ORDER, with one
+   free list per order.  An allocation of N pages takes the
+   smallest free block of at least N pages, splitting bigger
+   blocks in halves, and gives back the tail it does not need.
+   A freed block is merged with its "buddy", the other half of
+   the block the two were split from, for as long as the buddy
+   is free too.  Both take O(log n) steps, where scanning a
+   bitmap took time linear in the pool size.
+
+   A dying thread's page is freed from the scheduler, so the
+   free lists are protected by disabling interrupts, not by a
+   lock. */
+
+/* The idle thread zeroes free pages ahead of time, so that most
+   single-page PAL_ZERO requests need no memset.  Pre-zeroed pages
+   leave the buddy lists for a pool's zero_list, but still count
+   as free: other requests use them when nothing else is left.
+   Each pool keeps up to 1/32 of its pages, at most ZERO_MAX,
+   pre-zeroed. */
+#define ZERO_MAX 128
+
+/* Number of block orders: blocks of up to 2**15 pages, 128 MB. */
+#define BUDDY_ORDERS 16
+
+/* order_map[] flag for the first page of a free block. */
+#define BUDDY_FREE 0x80
+
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *used_map;            /* Bitmap of used pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t base_pfn;                    /* Frame number of BASE. */
+    uint8_t *order_map;                 /* Per page, BUDDY_FREE | order
+                                           if it heads a free block,
+                                           otherwise 0. */
+    struct list free_list[BUDDY_ORDERS];/* Free blocks of each order. */
+    size_t free_cnt;                    /* Number of free pages. */
+    struct list zero_list;              /* Pre-zeroed free pages. */
+    size_t zero_cnt;                    /* Pages in zero_list. */
+    size_t zero_target;                 /* Pages to keep in zero_list. */
+
+    /* Statistics. */
+    long long zero_hit_cnt;             /* PAL_ZERO pages from zero_list. */
+    long long zero_miss_cnt;            /* PAL_ZERO pages zeroed on demand. */
+    long long zero_idle_cnt;            /* Pages zeroed by the idle thread. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -38,7 +81,13 @@ static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+static bool page_from_pool (const struct pool *, const void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt, size_t align);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t take_zeroed (struct pool *);
+static void flush_zeroed (struct pool *);
+static bool zero_one (struct pool *);
+static void print_pool_stats (struct pool *, const char *name);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -69,17 +118,61 @@ palloc_init (size_t user_page_limit)
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return palloc_get_aligned (flags, page_cnt, 1);
+}
+
+/* Like palloc_get_multiple(), but the physical address of the
+   first page is a multiple of ALIGN pages, as needed for a 4 MB
+   page mapping. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  bool single = page_cnt == 1 && align == 1;
+  bool zeroed = false;
+  enum intr_level old_level;
   void *pages;
-  size_t page_idx;
+  size_t page_idx = BITMAP_ERROR;
 
+  ASSERT (align > 0 && (align & (align - 1)) == 0);
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  old_level = intr_disable ();
+  if (single && (flags & PAL_ZERO))
+    page_idx = take_zeroed (pool);
+  zeroed = page_idx != BITMAP_ERROR;
+  if (!zeroed)
+    page_idx = buddy_alloc (pool, page_cnt, align);
+  if (page_idx == BITMAP_ERROR && pool->zero_cnt > 0)
+    {
+      /* Only pre-zeroed pages are left.  Use them as well. */
+      if (single)
+        {
+          page_idx = take_zeroed (pool);
+          zeroed = true;
+        }
+      else
+        {
+          flush_zeroed (pool);
+          page_idx = buddy_alloc (pool, page_cnt, align);
+        }
+    }
+  if (page_idx != BITMAP_ERROR)
+    {
+      ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+      pool->free_cnt -= page_cnt;
+      if (single && (flags & PAL_ZERO))
+        {
+          if (zeroed)
+            pool->zero_hit_cnt++;
+          else
+            pool->zero_miss_cnt++;
+        }
+    }
+  intr_set_level (old_level);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -88,7 +181,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -119,6 +212,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -137,8 +231,12 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  buddy_free (pool, page_idx, page_cnt);
+  pool->free_cnt += page_cnt;
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,31 +246,278 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool.  The count may
+   be stale by the time the caller looks at it. */
+size_t
+palloc_free_cnt (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return pool->free_cnt;
+}
+
+/* Returns the total number of pages in the user pool if
+   PAL_USER is set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_page_cnt (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return bitmap_size (pool->used_map);
+}
+
+/* Returns the index of PAGE within the user pool if PAL_USER is
+   set in FLAGS, otherwise within the kernel pool, or SIZE_MAX if
+   PAGE is not from that pool. */
+size_t
+palloc_page_idx (enum palloc_flags flags, const void *page)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  if (!page_from_pool (pool, page))
+    return SIZE_MAX;
+  return pg_no (page) - pg_no (pool->base);
+}
+
+/* Zeroes one free page for the pre-zeroed list of a pool that is
+   short of its target.  Called by the idle thread, with
+   interrupts on.  Returns false if there was nothing to do. */
+bool
+palloc_zero_idle (void)
+{
+  return zero_one (&kernel_pool) || zero_one (&user_pool);
+}
+
+/* Prints the number of free pages of each pool and how badly
+   they are fragmented. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool, "Kernel pool");
+  print_pool_stats (&user_pool, "User pool");
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and order_map at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_size = ROUND_UP (bitmap_buf_size (page_cnt), sizeof (long));
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  size_t i;
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  /* Initialize the pool, putting all of its pages on the buddy
+     free lists. */
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order_map = (uint8_t *) base + bm_size;
+  memset (p->order_map, 0, page_cnt);
   p->base = base + bm_pages * PGSIZE;
+  p->base_pfn = vtop (p->base) >> PGBITS;
+  for (i = 0; i < BUDDY_ORDERS; i++)
+    list_init (&p->free_list[i]);
+  buddy_free (p, 0, page_cnt);
+  p->free_cnt = page_cnt;
+  list_init (&p->zero_list);
+  p->zero_cnt = 0;
+  p->zero_target = page_cnt / 32 < ZERO_MAX ? page_cnt / 32 : ZERO_MAX;
+  p->zero_hit_cnt = p->zero_miss_cnt = p->zero_idle_cnt = 0;
+}
+
+/* Returns the free list element kept in page PAGE_IDX of POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX into POOL,
+   merging it with its buddy as far as possible. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order)
+{
+  size_t page_cnt = bitmap_size (pool->used_map);
+
+  while (order < BUDDY_ORDERS - 1)
+    {
+      size_t buddy_pfn = (pool->base_pfn + page_idx) ^ ((size_t) 1 << order);
+      size_t buddy_idx = buddy_pfn - pool->base_pfn;
+
+      if (buddy_pfn < pool->base_pfn || buddy_idx >= page_cnt
+          || pool->order_map[buddy_idx] != (BUDDY_FREE | order))
+        break;
+      list_remove (block_elem (pool, buddy_idx));
+      pool->order_map[buddy_idx] = 0;
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+  pool->order_map[page_idx] = BUDDY_FREE | order;
+  list_push_front (&pool->free_list[order], block_elem (pool, page_idx));
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX of POOL, as the largest
+   aligned blocks they divide into. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      size_t pfn = pool->base_pfn + page_idx;
+      int order = 0;
+
+      while (order < BUDDY_ORDERS - 1
+             && (pfn & (((size_t) 2 << order) - 1)) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Takes PAGE_CNT contiguous pages, the first of them aligned to
+   ALIGN pages, out of POOL.  Returns the index of the first page,
+   or BITMAP_ERROR if no block is large enough. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt, size_t align)
+{
+  size_t need = page_cnt > align ? page_cnt : align;
+  size_t page_idx;
+  int order = 0, i;
+
+  while (((size_t) 1 << order) < need)
+    if (++order >= BUDDY_ORDERS)
+      return BITMAP_ERROR;
+
+  for (i = order; i < BUDDY_ORDERS; i++)
+    if (!list_empty (&pool->free_list[i]))
+      break;
+  if (i == BUDDY_ORDERS)
+    return BITMAP_ERROR;
+
+  page_idx = ((uint8_t *) list_pop_front (&pool->free_list[i])
+              - pool->base) / PGSIZE;
+  pool->order_map[page_idx] = 0;
+
+  /* Split down to the needed order, freeing the upper halves. */
+  while (i > order)
+    {
+      size_t half;
+
+      i--;
+      half = page_idx + ((size_t) 1 << i);
+      pool->order_map[half] = BUDDY_FREE | i;
+      list_push_front (&pool->free_list[i], block_elem (pool, half));
+    }
+
+  /* Give back the tail beyond PAGE_CNT. */
+  buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+  return page_idx;
+}
+
+/* Takes a page off POOL's zero_list and returns its index, or
+   BITMAP_ERROR if the list is empty.  Interrupts must be off. */
+static size_t
+take_zeroed (struct pool *pool)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (list_empty (&pool->zero_list))
+    return BITMAP_ERROR;
+  e = list_pop_front (&pool->zero_list);
+  pool->zero_cnt--;
+
+  /* The list element was the only nonzero part of the page. */
+  memset (e, 0, sizeof *e);
+  return ((uint8_t *) e - pool->base) / PGSIZE;
+}
+
+/* Returns all of POOL's pre-zeroed pages to the buddy lists, so
+   that they can merge into multi-page blocks again.  Interrupts
+   must be off. */
+static void
+flush_zeroed (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  while (!list_empty (&pool->zero_list))
+    {
+      struct list_elem *e = list_pop_front (&pool->zero_list);
+      buddy_free (pool, ((uint8_t *) e - pool->base) / PGSIZE, 1);
+    }
+  pool->zero_cnt = 0;
+}
+
+/* Moves one free page of POOL to its zero_list, zeroing it with
+   interrupts on.  Returns false if POOL has enough pre-zeroed
+   pages or no free page. */
+static bool
+zero_one (struct pool *pool)
+{
+  enum intr_level old_level;
+  size_t page_idx;
+  uint8_t *page;
+
+  if (pool->zero_cnt >= pool->zero_target)
+    return false;
+
+  old_level = intr_disable ();
+  page_idx = buddy_alloc (pool, 1, 1);
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = pool->base + PGSIZE * page_idx;
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  list_push_back (&pool->zero_list, (struct list_elem *) page);
+  pool->zero_cnt++;
+  pool->zero_idle_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Prints free pages, free blocks and the largest free block of
+   POOL.  The fragmentation figure is the share of free pages
+   outside the largest block, not counting pre-zeroed pages. */
+static void
+print_pool_stats (struct pool *pool, const char *name)
+{
+  enum intr_level old_level = intr_disable ();
+  size_t free_cnt = pool->free_cnt - pool->zero_cnt;
+  size_t block_cnt = 0, largest = 0;
+  int i;
+
+  for (i = 0; i < BUDDY_ORDERS; i++)
+    {
+      size_t n = list_size (&pool->free_list[i]);
+      block_cnt += n;
+      if (n > 0)
+        largest = (size_t) 1 << i;
+    }
+  intr_set_level (old_level);
+
+  printf ("%s: %zu of %zu pages free in %zu blocks, largest %zu pages, "
+          "%zu%% fragmented\n", name, free_cnt,
+          bitmap_size (pool->used_map), block_cnt, largest,
+          free_cnt > 0 ? 100 - largest * 100 / free_cnt : 0);
+  printf ("%s: %zu more pages free pre-zeroed, %lld of %lld zeroed "
+          "requests served without memset, %lld pages zeroed when idle\n",
+          name, pool->zero_cnt, pool->zero_hit_cnt,
+          pool->zero_hit_cnt + pool->zero_miss_cnt, pool->zero_idle_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
-page_from_pool (const struct pool *pool, void *page) 
+page_from_pool (const struct pool *pool, const void *page) 
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
@@ -66,6 +66,14 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+
+/* A PDE with PTE_PS set maps a 4 MB "large page" directly,
+   without a page table, if CR4.PSE is enabled.  See [IA32-v3a]
+   3.7.3 "Mixing 4-KByte and 4-MByte Pages". */
+#define LARGE_PGSIZE (1 << PDSHIFT)     /* Bytes in a large page. */
+#define LARGE_PGMASK (LARGE_PGSIZE - 1) /* Offset bits in a large page. */
+#define LARGE_PGPAGES (LARGE_PGSIZE / PGSIZE)  /* Pages per large page. */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -80,6 +88,15 @@ static inline uint32_t *pde_get_pt (uint32_t pde) {
   return ptov (pde & PTE_ADDR);
 }
 
+/* Returns a PDE that maps the 4 MB page at PAGE, which must be
+   4 MB aligned.  If USER is false, only the kernel may use it. */
+static inline uint32_t pde_create_large (void *page, bool writable,
+                                         bool user) {
+  ASSERT ((vtop (page) & LARGE_PGMASK) == 0);
+  return vtop (page) | PTE_PS | PTE_P | (writable ? PTE_W : 0)
+         | (user ? PTE_U : 0);
+}
+
 /* Returns a PTE that points to PAGE.
    The PTE's page is readable.
    If WRITABLE is true then it will be writable as well.
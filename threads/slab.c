@@ -0,0 +1,231 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator for kernel objects of one type.
+
+   Each cache hands out objects of a single size from "slabs",
+   pages obtained from the page allocator and carved into as
+   many objects as fit after a small header.  Unlike malloc(),
+   no space is lost rounding the size up to a power of 2, and a
+   cache's lock is contended only by users of that one type.
+
+   A slab is on one of three lists of its cache: partial (some
+   objects free), full, or empty.  Objects are taken from
+   partial slabs first, so that the objects in use gather in few
+   slabs.  One empty slab is kept to absorb alloc/free cycles at
+   a slab boundary, further empty slabs go back to the page
+   allocator.
+
+   If a cache has a constructor, it runs once per object when
+   the slab is created, not on every allocation, so objects must
+   be freed back in their constructed state.  The free list link
+   is stored past the end of the object for that reason. */
+
+/* Object alignment. */
+#define SLAB_ALIGN 8
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Object cache. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Object size, including free link. */
+    size_t link_ofs;            /* Offset of the free link in objects. */
+    size_t objs_per_slab;       /* Objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct list partial;        /* Slabs with free and used objects. */
+    struct list full;           /* Slabs without free objects. */
+    struct list empty;          /* Slabs without used objects. */
+    struct lock lock;           /* Protects all of the above. */
+    struct list_elem elem;      /* Element in cache_list. */
+
+    /* Statistics. */
+    size_t in_use;              /* Objects allocated. */
+    size_t slab_cnt;            /* Slabs owned. */
+    long long alloc_cnt;        /* Allocations so far. */
+  };
+
+/* Slab header, at the start of each slab page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in a list of the cache. */
+    size_t in_use;              /* Objects allocated from the slab. */
+    void *free;                 /* First free object, or null. */
+  };
+
+/* All caches, for statistics. */
+static struct list cache_list = LIST_INITIALIZER (cache_list);
+
+static struct slab *new_slab (struct kmem_cache *);
+static void **free_link (struct kmem_cache *, void *obj);
+
+/* Creates a cache for objects of SIZE bytes, which runs CTOR,
+   if non-null, on each new object.  The cache lives forever.
+   Panics if memory is not available, since caches are created
+   at boot. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c = malloc (sizeof *c);
+  size_t first_ofs = ROUND_UP (sizeof (struct slab), SLAB_ALIGN);
+
+  if (c == NULL)
+    PANIC ("kmem_cache_create: out of memory for %s", name);
+
+  c->name = name;
+  c->link_ofs = ROUND_UP (size, sizeof (void *));
+  c->obj_size = ROUND_UP (c->link_ofs + sizeof (void *), SLAB_ALIGN);
+  c->objs_per_slab = (PGSIZE - first_ofs) / c->obj_size;
+  ASSERT (c->objs_per_slab > 0);
+  c->ctor = ctor;
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  lock_init (&c->lock);
+  c->in_use = 0;
+  c->slab_cnt = 0;
+  c->alloc_cnt = 0;
+  list_push_back (&cache_list, &c->elem);
+  return c;
+}
+
+/* Returns a new object from cache C, or a null pointer if
+   memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  else
+    {
+      s = new_slab (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  obj = s->free;
+  s->free = *free_link (c, obj);
+  if (++s->in_use == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_back (&c->full, &s->elem);
+    }
+  c->in_use++;
+  c->alloc_cnt++;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  A null OBJ is ignored. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  lock_acquire (&c->lock);
+  *free_link (c, obj) = s->free;
+  s->free = obj;
+  c->in_use--;
+  if (s->in_use-- == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  if (s->in_use == 0)
+    {
+      list_remove (&s->elem);
+      if (list_empty (&c->empty))
+        list_push_back (&c->empty, &s->elem);
+      else
+        {
+          s->magic = 0;
+          c->slab_cnt--;
+          palloc_free_page (s);
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Prints statistics of every cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      printf ("Slab %s: %zu objects in use, %zu slabs, %lld allocations\n",
+              c->name, c->in_use, c->slab_cnt, c->alloc_cnt);
+    }
+}
+
+/* Allocates a slab for cache C, constructing its objects and
+   chaining them on its free list.  C's lock must be held. */
+static struct slab *
+new_slab (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  uint8_t *obj;
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+  obj = (uint8_t *) s + ROUND_UP (sizeof *s, SLAB_ALIGN)
+        + (c->objs_per_slab - 1) * c->obj_size;
+  for (i = 0; i < c->objs_per_slab; i++, obj -= c->obj_size)
+    {
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *free_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns the free list link of OBJ in cache C. */
+static void **
+free_link (struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
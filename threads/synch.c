@@ -27,12 +27,23 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef LOCK_STATS
+#include "devices/timer.h"
 
-void remove_donation_list (struct lock *lock);
+/* Here lock_init() and rwlock_init() are the plain functions,
+   which leave the lock without a class. */
+#undef lock_init
+#undef rwlock_init
+#endif
+
+static void sema_wake (struct semaphore *);
+static void lock_take (struct lock *);
+static void lock_unlock (struct lock *);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -49,7 +60,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  waitq_init (&sema->waiters);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -70,10 +81,7 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      /* Original code 
-      list_push_back (&sema->waiters, &thread_current ()->elem); */
-      list_insert_ordered (&sema->waiters, &thread_current ()->elem,
-          thread_less_func, 0);
+      waitq_push (&sema->waiters, thread_current ());
       thread_block ();
     }
   sema->value--;
@@ -118,17 +126,24 @@ sema_up (struct semaphore *sema)
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)) 
-  {
-    list_sort (&sema->waiters, thread_less_func, 0); /* Added code */
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
-  }
-  sema->value++;
+  sema_wake (sema);
   thread_priority_check ();   /*Added code */
   intr_set_level (old_level);
 }
 
+/* Increments SEMA and unblocks its highest priority waiter, if
+   any, without yielding to it. */
+static void
+sema_wake (struct semaphore *sema)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (!waitq_empty (&sema->waiters))
+    thread_unblock (waitq_pop (&sema->waiters));
+  sema->value++;
+  intr_set_level (old_level);
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -188,6 +203,10 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->max_priority = PRI_MIN;
+#ifdef LOCK_STATS
+  lock->class = NULL;
+#endif
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -202,20 +221,39 @@ void
 lock_acquire (struct lock *lock)
 {
   struct thread *t = thread_current();
+  enum intr_level old_level;
+#ifdef LOCK_STATS
+  bool contended;
+  int64_t start;
+#endif
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  if (lock->holder != NULL)
+  old_level = intr_disable ();
+#ifdef LOCK_STATS
+  contended = lock->semaphore.value == 0;
+  start = timer_ticks ();
+#endif
+
+  /* The MLFQS does not donate priority. */
+  if (lock->holder != NULL && !thread_mlfqs)
   {
     t->lock_add = lock;
-    list_insert_ordered (&lock->holder->donation, &t->donate_elem,
-        thread_less_func, 0);
     thread_priority_donation (t);
   }
   sema_down (&lock->semaphore);
+#ifdef LOCK_STATS
+  if (contended && lock->class != NULL)
+    {
+      lock->class->contended_cnt++;
+      lock->class->wait_ticks += timer_elapsed (start);
+    }
+#endif
   t->lock_add = NULL;     /* Initialize lock_add. */
-  lock->holder = t;
+  lock_take (lock);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -227,17 +265,41 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    lock_take (lock);
+  intr_set_level (old_level);
   return success;
 }
 
+/* Makes the current thread the holder of LOCK, which it has just
+   downed.  Threads still waiting on LOCK now donate to it. */
+static void
+lock_take (struct lock *lock)
+{
+  struct thread *t = thread_current ();
+  struct thread *top = waitq_front (&lock->semaphore.waiters);
+
+  lock->holder = t;
+  lock->max_priority = top != NULL ? top->priority : PRI_MIN;
+  list_insert_ordered (&t->held_locks, &lock->elem,
+                       lock_priority_greater, NULL);
+  if (!thread_mlfqs && lock->max_priority > t->priority)
+    thread_priority_refresh ();
+#ifdef LOCK_STATS
+  if (lock->class != NULL)
+    lock->class->acquire_cnt++;
+  lock->acquired = timer_ticks ();
+#endif
+}
+
 /* Releases LOCK, which must be owned by the current thread.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -249,35 +311,42 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  lock_unlock (lock);
+  thread_priority_check ();
+}
+
+/* Releases LOCK like lock_release(), but leaves the CPU to the
+   current thread even if a waiter of higher priority wakes. */
+static void
+lock_unlock (struct lock *lock)
+{
+  enum intr_level old_level = intr_disable ();
+
+#ifdef LOCK_STATS
+  if (lock->class != NULL
+      && timer_elapsed (lock->acquired) > lock->class->max_hold_ticks)
+    lock->class->max_hold_ticks = timer_elapsed (lock->acquired);
+#endif
   lock->holder = NULL;
+  list_remove (&lock->elem);
 
-  /* Added codes from priority donation. */
-  remove_donation_list (lock);
-  thread_priority_refresh ();
+  /* Added codes from priority donation.  The waiters of LOCK stop
+     donating to us. */
+  if (!thread_mlfqs)
+    thread_priority_refresh ();
 
-  sema_up (&lock->semaphore);
+  sema_wake (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
-/* Added codes from priority donation. Eliminate current lock's
-   waiting threads from donation LIST. */
-void
-remove_donation_list (struct lock *lock)
+/* Orders locks by the priority donated through them, highest
+   first. */
+bool
+lock_priority_greater (const struct list_elem *a,
+                       const struct list_elem *b, void *aux UNUSED)
 {
-  struct thread *t = thread_current ();
-  struct list_elem *e;
-  struct list_elem *tmp;
-  
-  if (list_empty (&t->donation))
-    return;
-
-  for (e = list_begin (&t->donation); e != list_end (&t->donation); e = tmp)
-  {
-    struct thread *cur = list_entry (e, struct thread, donate_elem);
-    tmp = list_next (e);
-    if (lock == cur->lock_add)
-      list_remove (e);
-  }
-  return;
+  return (list_entry (a, struct lock, elem)->max_priority
+          > list_entry (b, struct lock, elem)->max_priority);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -290,14 +359,84 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
-
-/* One semaphore in a list. */
-struct semaphore_elem 
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-  };
 
+#ifdef LOCK_STATS
+/* Classes of the locks initialized so far. */
+static struct list lock_classes = LIST_INITIALIZER (lock_classes);
+
+/* Number of classes printed by lock_print_stats(). */
+int lock_stats_top;
+
+/* Adds CLASS to lock_classes, unless it is there already. */
+static void
+register_class (struct lock_class *class)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (!class->registered)
+    {
+      class->registered = true;
+      list_push_back (&lock_classes, &class->elem);
+    }
+  intr_set_level (old_level);
+}
+
+/* Initializes LOCK like lock_init() and counts it in CLASS. */
+void
+lock_init_class (struct lock *lock, struct lock_class *class)
+{
+  lock_init (lock);
+  lock->class = class;
+  register_class (class);
+}
+
+/* Orders lock classes by contended acquisitions, then by ticks
+   waited, most first. */
+static bool
+class_more_contended (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct lock_class *a = list_entry (a_, struct lock_class, elem);
+  const struct lock_class *b = list_entry (b_, struct lock_class, elem);
+
+  if (a->contended_cnt != b->contended_cnt)
+    return a->contended_cnt > b->contended_cnt;
+  return a->wait_ticks > b->wait_ticks;
+}
+
+/* Prints the lock_stats_top most contended lock classes. */
+void
+lock_print_stats (void)
+{
+  enum intr_level old_level;
+  struct list_elem *e;
+  int i;
+
+  if (lock_stats_top <= 0)
+    return;
+
+  old_level = intr_disable ();
+  list_sort (&lock_classes, class_more_contended, NULL);
+  intr_set_level (old_level);
+
+  for (e = list_begin (&lock_classes), i = 0;
+       e != list_end (&lock_classes) && i < lock_stats_top;
+       e = list_next (e), i++)
+    {
+      struct lock_class *c = list_entry (e, struct lock_class, elem);
+      const char *file = c->file;
+
+      /* Sources are compiled from the build directory. */
+      while (!memcmp (file, "../", 3))
+        file += 3;
+      printf ("Lock %s (%s:%d): %lld acquires, %lld contended, "
+              "%"PRId64" ticks waiting, %"PRId64" ticks max hold\n",
+              c->name, file, c->line, c->acquire_cnt, c->contended_cnt,
+              c->wait_ticks, c->max_hold_ticks);
+    }
+}
+#endif
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -306,7 +445,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  waitq_init (&cond->waiters);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -332,46 +471,24 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
   
-  sema_init (&waiter.semaphore, 0);
-  /* Original code
-  list_push_back (&cond->waiters, &waiter.elem);  */
-  list_insert_ordered (&cond->waiters, &waiter.elem, cond_less_func, 0);
-  lock_release (lock);
-  sema_down (&waiter.semaphore);
+  /* The waiter sits in COND's queue itself.  It must not be
+     preempted between releasing LOCK and blocking, or a signal
+     could find it still running. */
+  old_level = intr_disable ();
+  waitq_push (&cond->waiters, thread_current ());
+  lock_unlock (lock);
+  thread_block ();
+  intr_set_level (old_level);
   lock_acquire (lock);
 }
 
-/* New added codes. */
-bool
-cond_less_func (const struct list_elem *a,
-    const struct list_elem *b, void *aux UNUSED)
-{
-  struct semaphore_elem *elem_a = list_entry (a, struct semaphore_elem, elem);
-  struct semaphore_elem *elem_b = list_entry (b, struct semaphore_elem, elem);
-
-  struct list_elem *ea;
-  struct list_elem *eb;
-
-  /* LIST 'semaphore->waiters' is LIST of blocked threads. 
-     Order of LIST can be changed at anytime when if H thread donates its priority
-     to L thread. So, LIST must be sorted before return the value. */
-  list_sort (&elem_a->semaphore.waiters, thread_less_func, 0);
-  list_sort (&elem_b->semaphore.waiters, thread_less_func, 0); 
-
-  ea = list_begin (&elem_a->semaphore.waiters);
-  eb = list_begin (&elem_b->semaphore.waiters);
-
-  return (list_entry (ea, struct thread, elem)->priority) 
-    > (list_entry (eb, struct thread, elem)->priority) ? true : false ;
-}
-
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -382,17 +499,18 @@ cond_less_func (const struct list_elem *a,
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters))
-  {
-    list_sort (&cond->waiters, cond_less_func, 0);
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
-  }
+  old_level = intr_disable ();
+  if (!waitq_empty (&cond->waiters))
+    thread_unblock (waitq_pop (&cond->waiters));
+  thread_priority_check ();
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -407,6 +525,323 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!waitq_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+
+/* Initializes RW.  A readers-writer lock admits either any
+   number of readers or a single writer.
+
+   The writer holds RW's lock for as long as it is inside, and
+   also while it waits for the readers to leave, so readers that
+   arrive after a writer wait behind it: writers are preferred.
+   Readers hold the lock only to enter, so any thread that waits
+   on it, reader or writer, donates its priority to the writer
+   that holds it. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  rw->readers = 0;
+  rw->draining = false;
+  sema_init (&rw->drained, 0);
+}
+
+#ifdef LOCK_STATS
+/* Initializes RW like rwlock_init() and counts it in CLASS. */
+void
+rwlock_init_class (struct rwlock *rw, struct lock_class *class)
+{
+  rwlock_init (rw);
+  rw->lock.class = class;
+  register_class (class);
+}
+#endif
+
+/* Acquires RW for reading, sleeping while a writer is inside or
+   waiting.  The current thread must not already hold RW. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  lock_acquire (&rw->lock);
+  old_level = intr_disable ();
+  rw->readers++;
+  intr_set_level (old_level);
+  lock_release (&rw->lock);
+  thread_current ()->rwlock_cnt++;
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0 && rw->draining)
+    {
+      rw->draining = false;
+      sema_up (&rw->drained);
+    }
+  intr_set_level (old_level);
+  thread_current ()->rwlock_cnt--;
+}
+
+/* Acquires RW for writing, sleeping until no other writer or
+   reader is inside.  The current thread must not already hold
+   RW. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  lock_acquire (&rw->lock);
+  old_level = intr_disable ();
+  if (rw->readers > 0)
+    {
+      rw->draining = true;
+      sema_down (&rw->drained);
+    }
+  intr_set_level (old_level);
+  thread_current ()->rwlock_cnt++;
+}
+
+/* Tries to acquire RW for writing without sleeping.  Returns
+   true if successful, false if a reader or writer is inside. */
+bool
+rwlock_try_acquire_write (struct rwlock *rw)
+{
+  if (!lock_try_acquire (&rw->lock))
+    return false;
+  if (rw->readers > 0)
+    {
+      lock_release (&rw->lock);
+      return false;
+    }
+  thread_current ()->rwlock_cnt++;
+  return true;
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  thread_current ()->rwlock_cnt--;
+  lock_release (&rw->lock);
+}
+
+/* Turns the current thread's hold on RW for writing into a hold
+   for reading, letting other readers in. */
+void
+rwlock_downgrade (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  rw->readers++;
+  intr_set_level (old_level);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  return lock_held_by_current_thread (&rw->lock) && rw->readers == 0;
+}
+
+/* Wait queues.
+
+   A pairing heap keeps the top waiter at the root, so waking one
+   costs O(log n) amortized instead of sorting a list on every
+   up.  Priorities of waiters change under donation, so a waiter
+   whose priority changes is cut out and melded back in by
+   waitq_set_priority().
+
+   Each node keeps its children in a list: wq_child is the
+   leftmost child, wq_next the right sibling, and wq_prev the
+   left sibling, or the parent for a leftmost child.  Callers
+   must disable interrupts. */
+
+/* Order of joining a queue, to keep equal priorities FIFO. */
+static unsigned waitq_seq;
+
+static struct thread *meld (struct thread *, struct thread *);
+static struct thread *merge_pairs (struct thread *);
+static void waitq_remove (struct waitq *, struct thread *);
+
+/* Initializes Q as empty. */
+void
+waitq_init (struct waitq *q)
+{
+  q->root = NULL;
+}
+
+/* Returns true if nothing waits on Q. */
+bool
+waitq_empty (const struct waitq *q)
+{
+  return q->root == NULL;
+}
+
+/* Adds T to Q. */
+void
+waitq_push (struct waitq *q, struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->waitq == NULL);
+
+  t->waitq = q;
+  t->wq_seq = waitq_seq++;
+  t->wq_child = t->wq_next = t->wq_prev = NULL;
+  q->root = meld (q->root, t);
+}
+
+/* Returns the highest priority waiter of Q, or NULL. */
+struct thread *
+waitq_front (const struct waitq *q)
+{
+  return q->root;
+}
+
+/* Removes and returns the highest priority waiter of Q, which
+   must not be empty. */
+struct thread *
+waitq_pop (struct waitq *q)
+{
+  struct thread *t = q->root;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t != NULL);
+
+  waitq_remove (q, t);
+  return t;
+}
+
+/* Sets the priority of T, which waits on a queue, to PRIORITY
+   and moves it to its new place there.  T keeps its arrival
+   order among waiters of equal priority. */
+void
+waitq_set_priority (struct thread *t, int priority)
+{
+  struct waitq *q = t->waitq;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (q != NULL);
+
+  waitq_remove (q, t);
+  t->priority = priority;
+  t->waitq = q;
+  q->root = meld (q->root, t);
+}
+
+/* Returns true if A should wake before B. */
+static bool
+waitq_before (const struct thread *a, const struct thread *b)
+{
+  if (a->priority != b->priority)
+    return a->priority > b->priority;
+  return (int) (a->wq_seq - b->wq_seq) < 0;
+}
+
+/* Melds heaps A and B, either of which may be NULL, and returns
+   the root.  The roots must not have siblings. */
+static struct thread *
+meld (struct thread *a, struct thread *b)
+{
+  struct thread *tmp;
+
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (waitq_before (b, a))
+    {
+      tmp = a;
+      a = b;
+      b = tmp;
+    }
+
+  /* B becomes the leftmost child of A. */
+  b->wq_prev = a;
+  b->wq_next = a->wq_child;
+  if (a->wq_child != NULL)
+    a->wq_child->wq_prev = b;
+  a->wq_child = b;
+  return a;
+}
+
+/* Melds the sibling list starting at FIRST into one heap, in the
+   usual two passes: pairs from left to right, then the pairs
+   from right to left. */
+static struct thread *
+merge_pairs (struct thread *first)
+{
+  struct thread *pairs = NULL;
+  struct thread *root = NULL;
+
+  while (first != NULL)
+    {
+      struct thread *a = first;
+      struct thread *b = a->wq_next;
+      struct thread *m;
+
+      first = b != NULL ? b->wq_next : NULL;
+      a->wq_next = a->wq_prev = NULL;
+      if (b != NULL)
+        b->wq_next = b->wq_prev = NULL;
+      m = meld (a, b);
+
+      /* Stack the pairs, so the second pass sees the last first. */
+      m->wq_next = pairs;
+      pairs = m;
+    }
+
+  while (pairs != NULL)
+    {
+      struct thread *m = pairs;
+
+      pairs = m->wq_next;
+      m->wq_next = NULL;
+      root = meld (root, m);
+    }
+  return root;
+}
+
+/* Removes T from Q. */
+static void
+waitq_remove (struct waitq *q, struct thread *t)
+{
+  struct thread *sub;
+
+  ASSERT (t->waitq == q);
+
+  if (t != q->root)
+    {
+      if (t->wq_prev->wq_child == t)
+        t->wq_prev->wq_child = t->wq_next;
+      else
+        t->wq_prev->wq_next = t->wq_next;
+      if (t->wq_next != NULL)
+        t->wq_next->wq_prev = t->wq_prev;
+    }
+
+  sub = merge_pairs (t->wq_child);
+  if (t == q->root)
+    q->root = sub;
+  else
+    q->root = meld (q->root, sub);
+  if (q->root != NULL)
+    q->root->wq_prev = NULL;
+
+  t->waitq = NULL;
+  t->wq_child = t->wq_next = t->wq_prev = NULL;
+}
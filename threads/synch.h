@@ -3,12 +3,30 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Threads blocked on a semaphore or condition variable, highest
+   priority first and in arrival order among equal priorities.
+   A pairing heap linked through the threads themselves. */
+struct waitq
+  {
+    struct thread *root;        /* Highest priority waiter, or NULL. */
+  };
+
+void waitq_init (struct waitq *);
+bool waitq_empty (const struct waitq *);
+void waitq_push (struct waitq *, struct thread *);
+struct thread *waitq_front (const struct waitq *);
+struct thread *waitq_pop (struct waitq *);
+void waitq_set_priority (struct thread *, int priority);
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct waitq waiters;       /* Waiting threads. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -22,6 +40,12 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    int max_priority;           /* Highest priority donated by waiters. */
+    struct list_elem elem;      /* Element in holder's held_locks. */
+#ifdef LOCK_STATS
+    struct lock_class *class;   /* Statistics, or null. */
+    int64_t acquired;           /* Tick at which holder acquired it. */
+#endif
   };
 
 void lock_init (struct lock *);
@@ -29,20 +53,75 @@ void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
-void remove_donation_list (struct lock *);
+bool lock_priority_greater (const struct list_elem *,
+                            const struct list_elem *, void *);
 
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct waitq waiters;       /* Waiting threads. */
   };
 
 void cond_init (struct condition *);
-bool cond_less_func (const struct list_elem *, const struct list_elem *, void *);
 void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Held by the writer. */
+    unsigned readers;           /* Number of readers inside. */
+    bool draining;              /* Writer waits for readers to leave. */
+    struct semaphore drained;   /* Upped by the last reader to leave. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+void rwlock_downgrade (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
+#ifdef LOCK_STATS
+/* Contention statistics, compiled in with -DLOCK_STATS.
+
+   Locks are counted by class: all locks initialized by one
+   lock_init() or rwlock_init() call in the source share a class,
+   named after the lock expression given there.  So every inode's
+   data_lock adds to one class, and swap_lock has its own. */
+struct lock_class
+  {
+    const char *name;           /* Lock expression, e.g. "&swap_lock". */
+    const char *file;           /* Source file of the lock_init(). */
+    int line;                   /* Line of the lock_init(). */
+    bool registered;            /* In the list of all classes? */
+    struct list_elem elem;      /* Element in the list of all classes. */
+    long long acquire_cnt;      /* Acquisitions. */
+    long long contended_cnt;    /* Acquisitions that had to wait. */
+    int64_t wait_ticks;         /* Total ticks spent waiting. */
+    int64_t max_hold_ticks;     /* Longest time a lock was held. */
+  };
+
+/* Number of most contended classes printed at shutdown.
+   Controlled by kernel command-line option "-lock-stats". */
+extern int lock_stats_top;
+
+void lock_init_class (struct lock *, struct lock_class *);
+void rwlock_init_class (struct rwlock *, struct lock_class *);
+void lock_print_stats (void);
+
+/* A class of its own for each place that initializes a lock. */
+#define LOCK_CLASS(LOCK)                                                \
+        ({ static struct lock_class lock_class_ =                       \
+             { .name = #LOCK, .file = __FILE__, .line = __LINE__ };     \
+           &lock_class_; })
+#define lock_init(LOCK) lock_init_class (LOCK, LOCK_CLASS (LOCK))
+#define rwlock_init(RW) rwlock_init_class (RW, LOCK_CLASS (RW))
+#endif
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -3,6 +3,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
@@ -23,13 +24,32 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* My new code. List of processes in THREAD_SLEEP state, that is,
-   processes that are sleeping and blocked.*/
-static struct list sleep_list;
-
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Threads blocked in timer_sleep(), as a binary min-heap
+   ordered by wakeup tick, so that the timer interrupt finds
+   the threads to wake without looking at the others.  Each
+   thread occupies a kernel page, so the heap never holds more
+   entries than there are kernel pages. */
+static struct thread **sleep_heap;
+static size_t sleep_cnt;
+
+/* Wakeup tick of the root of sleep_heap, or INT64_MAX if the heap
+   is empty.  Most timer ticks compare against it and stop. */
+static int64_t next_wakeup = INT64_MAX;
+
+/* Order in which threads went to sleep, which breaks ties in
+   sleep_heap so that threads with the same wakeup tick wake
+   first-come, first-served. */
+static unsigned next_sleep_seq;
+
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running: one FIFO queue per
+   priority, with bit N of ready_bitmap set if queue N is
+   nonempty, so that the next thread is found in constant time. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+
+/* Number of threads in THREAD_READY state. */
+static size_t ready_cnt;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -66,6 +86,13 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Number of lock holders a donation is passed along. */
+int thread_donate_depth = DONATE_DEPTH_DEFAULT;
+
+/* System load average, estimating the number of threads ready
+   to run over the past minute. */
+static fixed_t load_avg;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -75,9 +102,21 @@ static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
-void schedule_sleep (void);
+static bool sleep_less (const struct thread *, const struct thread *);
+static void sleep_sift_up (size_t idx);
+static void sleep_sift_down (size_t idx);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static struct thread *ready_pop (void);
+static bool ready_empty (void);
+static int ready_max_priority (void);
+static void mlfqs_tick (struct thread *);
+static void set_priority (struct thread *, int priority);
+static int mlfqs_priority (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_update_recent_cpu (struct thread *, void *coef);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -95,12 +134,14 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
-  list_init (&sleep_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -119,6 +160,11 @@ thread_start (void)
 {
   /* Create the idle thread. */
   struct semaphore idle_started;
+  size_t heap_size = palloc_page_cnt (0) * sizeof *sleep_heap;
+
+  sleep_heap = palloc_get_multiple (PAL_ASSERT,
+                                    DIV_ROUND_UP (heap_size, PGSIZE));
+
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
 
@@ -135,7 +181,6 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
-  struct list_elem *e = list_begin (&ready_list);   /* Added code. */
 
   /* Update statistics. */
   if (t == idle_thread)
@@ -147,8 +192,11 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
-  if ((t->priority) < (list_entry(e, struct thread, elem)->priority))
+  if (!ready_empty () && t->priority < ready_max_priority ())
     intr_yield_on_return ();                        /* Added code. */
   
   if (++thread_ticks >= TIME_SLICE)
@@ -290,10 +338,7 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  /* Original code.
-  list_push_back (&ready_list, &t->elem);
-  */
-  list_insert_ordered (&ready_list, &t->elem, thread_less_func, 0);
+  ready_push (t);
 
   t->status = THREAD_READY;
   intr_set_level (old_level);
@@ -370,115 +415,194 @@ thread_yield (void)
   old_level = intr_disable ();
 
   if (cur != idle_thread) 
-    /* Original code. 
-    list_push_back (&ready_list, &cur->elem);
-    */
-    list_insert_ordered (&ready_list, &cur->elem, thread_less_func, 0);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
-/* Added codes. It looks different compared to list_less_func at
- .../src/lib/kernel/list.h . The reason why the inequality direction is
- different is that the difference between PRIORITY and LIST_SORT().
- LARGER PRIORITY thread has priority. However, LIST_SORT() sorts
- in order to LESS integer value. That's why the inequality direction was
- inversed. */
-bool
-thread_less_func (const struct list_elem *a, 
-    const struct list_elem *b, void *aux UNUSED)
-{
-  return ( (list_entry(a, struct thread, elem)->priority)
-      >= (list_entry(b, struct thread, elem)->priority)? true : false );
-}
-
+/* Blocks the current thread until timer tick WAKEUP_TICK.
+   Returns at once if that tick has passed already. */
 void
-thread_sleep (int64_t ticks, int64_t start)
+thread_sleep (int64_t wakeup_tick)
 {
   struct thread *cur = thread_current ();
   enum intr_level old_level;
 
-  /* My new codes. When if timer_sleep ft is called, then
-  BLOCK current thread and add to sleep_list.  */
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
 
-  if (cur != idle_thread)
+  if (cur != idle_thread && wakeup_tick > timer_ticks ())
   {
-    cur->wait_cnt = ticks;
-    cur->wait_start = start;
-    list_push_back (&sleep_list, &cur->elem);
+    ASSERT (sleep_cnt < palloc_page_cnt (0));
+    cur->wakeup_tick = wakeup_tick;
+    cur->sleep_seq = next_sleep_seq++;
+    sleep_heap[sleep_cnt] = cur;
+    sleep_sift_up (sleep_cnt++);
+    next_wakeup = sleep_heap[0]->wakeup_tick;
     thread_block ();
   }
   intr_set_level (old_level);
-  /* My codes end. */
-  
-  return;
+}
+
+/* Wakes the sleeping threads whose wakeup tick is NOW or
+   earlier.  Called by the timer interrupt handler at each timer
+   tick, before thread_tick(), which preempts the running thread
+   if a woken thread has a higher priority. */
+void
+thread_wake (int64_t now)
+{
+  if (now < next_wakeup)
+    return;
+
+  while (sleep_cnt > 0 && sleep_heap[0]->wakeup_tick <= now)
+  {
+    struct thread *t = sleep_heap[0];
+
+    sleep_heap[0] = sleep_heap[--sleep_cnt];
+    sleep_sift_down (0);
+    thread_unblock (t);
+  }
+  next_wakeup = sleep_cnt > 0 ? sleep_heap[0]->wakeup_tick : INT64_MAX;
+}
+
+/* Returns the tick at which the next sleeping thread wakes up,
+   or INT64_MAX if no thread sleeps.  Interrupts must be off. */
+int64_t
+thread_next_wakeup (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return next_wakeup;
+}
+
+/* Returns true if A should wake before B. */
+static bool
+sleep_less (const struct thread *a, const struct thread *b)
+{
+  if (a->wakeup_tick != b->wakeup_tick)
+    return a->wakeup_tick < b->wakeup_tick;
+  return (int) (a->sleep_seq - b->sleep_seq) < 0;
+}
+
+/* Moves entry IDX of sleep_heap up to its place. */
+static void
+sleep_sift_up (size_t idx)
+{
+  struct thread *t = sleep_heap[idx];
+
+  while (idx > 0)
+  {
+    size_t parent = (idx - 1) / 2;
+    if (!sleep_less (t, sleep_heap[parent]))
+      break;
+    sleep_heap[idx] = sleep_heap[parent];
+    idx = parent;
+  }
+  sleep_heap[idx] = t;
+}
+
+/* Moves entry IDX of sleep_heap down to its place. */
+static void
+sleep_sift_down (size_t idx)
+{
+  struct thread *t;
+
+  if (idx >= sleep_cnt)
+    return;
+
+  t = sleep_heap[idx];
+  for (;;)
+  {
+    size_t child = idx * 2 + 1;
+    if (child >= sleep_cnt)
+      break;
+    if (child + 1 < sleep_cnt
+        && sleep_less (sleep_heap[child + 1], sleep_heap[child]))
+      child++;
+    if (!sleep_less (sleep_heap[child], t))
+      break;
+    sleep_heap[idx] = sleep_heap[child];
+    idx = child;
+  }
+  sleep_heap[idx] = t;
 }
 
 /* Added new code. Check the priority between current thread and
- first thread of ready_list. If preemption is needed, then yield CPU.  */
+ the highest ready thread. If preemption is needed, then yield CPU.  */
 void
 thread_priority_check (void) 
 {
-  struct list_elem *e = list_begin(&ready_list);
-  
-  if (list_empty (&ready_list))
+  if (ready_empty ())
     return;
 
-  if ((thread_current ()->priority) < list_entry(e, struct thread, elem)->priority)
-    thread_yield();
+  if (thread_current ()->priority < ready_max_priority ())
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
 
   return;
 }
 
-/* Added codes from priority donation. Check all locks related to current thread
-   and donate its priority. */
+/* Added codes from priority donation.  Passes the priority of
+   T, which is about to wait on T->lock_add, to the holder of that
+   lock, and on along the chain of holders that are themselves
+   waiting, for at most thread_donate_depth holders.  Stops early
+   at the first lock whose holder already runs at least as high.
+   Must be called with interrupts off. */
 void
 thread_priority_donation (struct thread *t)
 {
-  /* If lock address is NULL, then return. */
-  if (t->lock_add == NULL)
-    return;
-  
-  /* Check the priority between lock holder and thread. */
-  if (t->lock_add->holder->priority < t->priority)
-    t->lock_add->holder->priority = t->priority;
+  int priority = t->priority;
+  int depth;
 
-  /* Recurrsive call. */
-  thread_priority_donation (t->lock_add->holder);
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  return;
+  for (depth = 0; depth < thread_donate_depth && t->lock_add != NULL;
+       depth++)
+    {
+      struct lock *lock = t->lock_add;
+      struct thread *holder = lock->holder;
+
+      if (holder == NULL || priority <= lock->max_priority)
+        break;
+
+      /* Keep the holder's locks ordered by donated priority. */
+      lock->max_priority = priority;
+      list_remove (&lock->elem);
+      list_insert_ordered (&holder->held_locks, &lock->elem,
+                           lock_priority_greater, NULL);
+
+      if (holder->priority >= priority)
+        break;
+      set_priority (holder, priority);
+      t = holder;
+    }
 }
 
-/* Added codes from priority donation. Check the current thread's priority. */
+/* Added codes from priority donation.  Sets the current thread's
+   priority to the higher of its own and the highest donated
+   through a lock it holds, which heads held_locks. */
 void 
 thread_priority_refresh (void)
 {
   struct thread *t = thread_current ();
-  struct list_elem *e;
   int max = t->old_priority;
-  
-  if (list_empty (&t->donation))
-  {
-    t->priority = max;
-    return;
-  }
-  else
-  {
-    for (e = list_begin (&t->donation); e != list_end (&t->donation);
-         e = list_next (e))
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&t->held_locks))
     {
-      struct thread *f = list_entry (e, struct thread, donate_elem);
-      if (f->priority > max)
-        max = f->priority;
+      struct lock *top = list_entry (list_front (&t->held_locks),
+                                     struct lock, elem);
+      if (top->max_priority > max)
+        max = top->max_priority;
     }
-    t->priority = max;
-  }
-
-  return;
+  set_priority (t, max);
+  intr_set_level (old_level);
 }
 
 /* Invoke function 'func' on all threads, passing along 'aux'.
@@ -502,13 +626,11 @@ thread_foreach (thread_action_func *func, void *aux)
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
-
-  /* Check the donate option. */
-  if (thread_current ()->priority > thread_current ()->old_priority)
-    thread_priority_donation (thread_current ());
+  /* The MLFQS computes priorities itself. */
+  if (thread_mlfqs)
+    return;
 
-  /* Refresh the highest priority. */
+  /* Donations received still apply on top of the new priority. */
   thread_current ()->old_priority = new_priority;
   thread_priority_refresh ();
 
@@ -523,35 +645,138 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it is no longer the highest. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_priority_check ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent;
+}
+
+/* Updates the MLFQS state at a timer tick with T running.
+
+   Between the once-a-second decay of every thread's recent_cpu,
+   only the running thread's recent_cpu changes, so only its
+   priority has to be recomputed on every fourth tick.  The
+   priorities of all threads are recomputed once a second. */
+static void
+mlfqs_tick (struct thread *t)
+{
+  int64_t ticks = timer_ticks ();
+
+  if (t != idle_thread)
+    t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      int ready = ready_cnt + (t != idle_thread);
+      fixed_t twice_load, coef;
+
+      load_avg = fp_mul (fp_div (fp_int (59), fp_int (60)), load_avg)
+                 + fp_int (ready) / 60;
+      twice_load = load_avg * 2;
+      coef = fp_div (twice_load, fp_add_int (twice_load, 1));
+      thread_foreach (mlfqs_update_recent_cpu, &coef);
+    }
+  else if (ticks % 4 == 0)
+    mlfqs_update_priority (t);
+}
+
+/* Decays the recent_cpu of T by *COEF and recomputes its
+   priority. */
+static void
+mlfqs_update_recent_cpu (struct thread *t, void *coef)
+{
+  t->recent_cpu = fp_add_int (fp_mul (*(fixed_t *) coef, t->recent_cpu),
+                              t->nice);
+  mlfqs_update_priority (t);
+}
+
+/* Returns the MLFQS priority of T, computed from its recent_cpu
+   and nice value. */
+static int
+mlfqs_priority (struct thread *t)
+{
+  int priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Recomputes the priority of T.  Interrupts must be off. */
+static void
+mlfqs_update_priority (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t != idle_thread)
+    set_priority (t, mlfqs_priority (t));
+}
+
+/* Sets the priority of T to PRIORITY, moving T to the back of
+   its new run queue if it is ready, or to its new place in the
+   wait queue it is blocked on. */
+static void
+set_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level;
+
+  if (priority == t->priority)
+    return;
+
+  old_level = intr_disable ();
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else if (t->waitq != NULL)
+    waitq_set_priority (t, priority);
+  else
+    t->priority = priority;
+  intr_set_level (old_level);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -576,6 +801,19 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready to run.  Zero free pages for later
+         PAL_ZERO requests until there is no more to zero or some
+         thread becomes ready, and sleep only in the first case. */
+      intr_enable ();
+      while (ready_empty () && palloc_zero_idle ())
+        continue;
+      intr_disable ();
+      if (!ready_empty ())
+        continue;
+
+      /* In tickless mode, stop the timer until a sleeper is due. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -639,10 +877,23 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
 
+  /* Added codes for the MLFQS.  The initial thread starts with
+     zero nice and recent_cpu, other threads inherit them from
+     their parent. */
+  if (t != running_thread ())
+    {
+      t->nice = running_thread ()->nice;
+      t->recent_cpu = running_thread ()->recent_cpu;
+    }
+  if (thread_mlfqs)
+    t->priority = mlfqs_priority (t);
+
   /* Added codes from priority donation. */
   t->old_priority = priority;
-  list_init (&t->donation);
+  list_init (&t->held_locks);
   t->lock_add = NULL;
+  t->rwlock_cnt = 0;
+  t->waitq = NULL;
 
   /* Added codes for syscall process hierarchy. */ 
   list_init (&t->child_list);
@@ -677,10 +928,61 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  if (ready_empty ())
     return idle_thread;
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return ready_pop ();
+}
+
+/* Adds T to the back of the run queue of its priority. */
+static void
+ready_push (struct thread *t)
+{
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_bitmap |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its run queue. */
+static void
+ready_remove (struct thread *t)
+{
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_bitmap &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Removes and returns the first thread of the highest priority
+   in the run queue, which must not be empty. */
+static struct thread *
+ready_pop (void)
+{
+  struct list *queue = &ready_queues[ready_max_priority ()];
+  struct thread *t = list_entry (list_front (queue), struct thread, elem);
+
+  ready_remove (t);
+  return t;
+}
+
+/* Returns true if no thread is ready to run. */
+static bool
+ready_empty (void)
+{
+  return ready_cnt == 0;
+}
+
+/* Returns the highest priority of a ready thread, the highest
+   set bit of ready_bitmap.  The run queue must not be empty. */
+static int
+ready_max_priority (void)
+{
+  uint32_t high = ready_bitmap >> 32;
+
+  ASSERT (!ready_empty ());
+
+  return high != 0 ? 63 - __builtin_clz (high)
+                   : 31 - __builtin_clz ((uint32_t) ready_bitmap);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -747,7 +1049,9 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
-  schedule_sleep();
+  /* Tick again if the idle thread stopped the timer. */
+  if (cur == idle_thread)
+    timer_idle_exit ();
 
   if (cur != next)
     prev = switch_threads (cur, next);
@@ -755,29 +1059,6 @@ schedule (void)
 }
 
 
-/* Schedule codes for sleep list. */
-void
-schedule_sleep (void)
-{
-  struct list_elem *l = list_begin (&sleep_list);
-  
-  while (l != list_end (&sleep_list)) 
-  {
-    struct thread *t = list_entry (l, struct thread, elem);
-    if ( (t->wait_cnt) < timer_elapsed(t->wait_start) )
-    {
-      l = list_remove (l);
-      thread_unblock (t);
-      t->wait_cnt = 0;
-      t->wait_start = 0;
-    }
-    else
-      l = list_next (l);
-  }
-
-  return;
-}
-
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) 
@@ -4,10 +4,12 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 #include "filesys/file.h"
 #include "filesys/inode.h"
 #include "lib/kernel/hash.h"
+#include "vm/vma.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -28,6 +30,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread nice values. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -95,18 +102,27 @@ struct thread
     struct list_elem allelem;           /* List element for all threads list. */
 
 		/* Added codes. Used at alarm-clock. */ 
-		int64_t wait_cnt;										/* Sleep-list wait counter variable */		
-		int64_t wait_start;
+		int64_t wakeup_tick;                /* Tick to wake up at. */
+		unsigned sleep_seq;                 /* Order of going to sleep. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct waitq *waitq;                /* Wait queue blocked on, or NULL. */
+    struct thread *wq_child;            /* Wait queue heap links. */
+    struct thread *wq_next;
+    struct thread *wq_prev;
+    unsigned wq_seq;                    /* Order of joining the queue. */
 
 		/* Used in priority donation. */
-		int old_priority;
-		struct list donation;               /* List of threads which donate 
-																					 its priority to current thread. */
-		struct list_elem donate_elem;       /* List element for priority donation. */
+		int old_priority;                   /* Priority before donation. */
+		struct list held_locks;             /* Locks held, ordered by the
+																					 priority donated through them. */
 		struct lock *lock_add;              /* Lock address which is waiting for. */
+		int rwlock_cnt;                     /* Readers-writer locks held. */
+
+		/* Added codes for the MLFQS. */
+		int nice;                           /* Niceness. */
+		fixed_t recent_cpu;                 /* Recent CPU time received. */
 
     /* Add codes for syscall and process hierarchy. */
 		struct list child_list;             /* List of current thread's child process. */
@@ -128,6 +144,15 @@ struct thread
 
 		/* Added codes for VM. */
 		struct hash vm;
+		struct vma_tree vmas;               /* Virtual memory areas. */
+
+		/* Added codes for resident set accounting. */
+		size_t rss;                         /* Frames on lru_list owned. */
+		size_t rss_peak;                    /* Largest RSS so far. */
+		size_t wss;                         /* Estimated working set size. */
+		int64_t ws_sample_tick;             /* Time of the last WS sample. */
+		long long fault_cnt;                /* Pages faulted in. */
+		long long major_fault_cnt;          /* Of these, read from disk. */
 
 		/* Added codes for Memory Mapping File. */
 		struct list mmap_list;
@@ -145,6 +170,11 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* Number of lock holders a donation is passed along.
+   Controlled by kernel command-line option "-donate-depth". */
+#define DONATE_DEPTH_DEFAULT 8
+extern int thread_donate_depth;
+
 void thread_init (void);
 void thread_start (void);
 
@@ -167,9 +197,10 @@ void thread_priority_check (void);
 void thread_priority_donation (struct thread *);
 void thread_priority_refresh (void);
 
-bool thread_less_func (const struct list_elem *a, const struct list_elem *b, void *aux);
 
-void thread_sleep (int64_t ticks, int64_t start); /* Added header function. */
+void thread_sleep (int64_t wakeup_tick); /* Added header function. */
+void thread_wake (int64_t now);
+int64_t thread_next_wakeup (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -163,7 +163,7 @@ page_fault (struct intr_frame *f)
     /* handle_mm_fault. */
     if (vme)
     {
-      if (!handle_mm_fault (vme))
+      if (!handle_mm_fault (vme, write))
       {
         syscall_exit (-1);
         kill (f);
@@ -182,6 +182,9 @@ page_fault (struct intr_frame *f)
       }
     }
   }
+  /* First write to a page mapped to the shared zero frame. */
+  else if (write && unshare_zero_page (find_vme (fault_addr)))
+    return;
   else if (!user || !not_present)
   {
     syscall_exit (-1);
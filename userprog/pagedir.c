@@ -33,8 +33,9 @@ pagedir_destroy (uint32_t *pd)
     return;
 
   ASSERT (pd != init_page_dir);
+  /* 4 MB pages belong to their vm_area, which frees them. */
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if ((*pde & PTE_P) && !(*pde & PTE_PS))
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -52,7 +53,8 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   If VADDR lies in a 4 MB page, the PDE itself is returned. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -66,6 +68,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no (vaddr);
+  if (*pde & PTE_PS)
+    return pde;
   if (*pde == 0) 
     {
       if (create)
@@ -118,6 +122,36 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Maps the 4 MB of user virtual memory at UPAGE to the 4 MB
+   physical block at KPAGE, with a single PDE.  Both must be 4 MB
+   aligned, and no page of UPAGE's 4 MB may be mapped yet.
+   Returns false if PSE is off or UPAGE's range has a page
+   table already. */
+bool
+pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage,
+                        bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT (((uintptr_t) upage & LARGE_PGMASK) == 0);
+  ASSERT (is_user_vaddr ((uint8_t *) upage + LARGE_PGSIZE - 1));
+  ASSERT (vtop (kpage) >> PTSHIFT < init_ram_pages);
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (!pse_enabled || *pde != 0)
+    return false;
+  *pde = pde_create_large (kpage, writable, true);
+  return true;
+}
+
+/* Returns true if UPAGE is mapped by a 4 MB page in PD. */
+bool
+pagedir_is_large_page (uint32_t *pd, const void *upage)
+{
+  return (pd[pd_no (upage)] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS);
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -130,6 +164,10 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
   ASSERT (is_user_vaddr (uaddr));
   
   pte = lookup_page (pd, uaddr, false);
+  if (pte != NULL && (*pte & PTE_PS) != 0)
+    return (*pte & PTE_P) != 0
+           ? ptov ((*pte & ~LARGE_PGMASK) | ((uintptr_t) uaddr & LARGE_PGMASK))
+           : NULL;
   if (pte != NULL && (*pte & PTE_P) != 0)
     return pte_get_page (*pte) + pg_ofs (uaddr);
   else
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
@@ -17,6 +18,7 @@
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/pte.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "vm/page.h"
@@ -82,6 +84,7 @@ start_process (void *file_name_)
   }
 
   vm_init (&thread_current ()->vm);
+  vma_init (&thread_current ()->vmas);
 
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
@@ -231,6 +234,8 @@ process_exit (void)
 
   /* Added codes for VM. */
   syscall_munmap (CLOSE_ALL);
+  if (cur->pagedir != NULL)
+    frame_print_process_stats ();
   vm_destroy (&cur->vm);
 
   /* Close current thread working directory. */
@@ -419,6 +424,7 @@ static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
+static void map_large_pages (struct vm_area *);
 
 /* Loads an ELF executable from FILE_NAME into the current thread.
    Stores the executable's entry point into *EIP
@@ -441,7 +447,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
   process_activate ();
 
   /* Open executable file. */
-  lock_acquire (&filesys_lock);
   file = filesys_open (file_name);
   if (file == NULL) 
     {
@@ -542,13 +547,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
   /* We arrive here whether the load is successful or not. */
   //file_close (file);
 
-  lock_release (&filesys_lock);
   return success;
 }
 
 /* load() helpers. */
 
 static bool install_page (void *upage, void *kpage, bool writable);
+static void swap_read_ahead (void *uaddr, size_t slot);
+static void mmap_fault_around (struct vm_entry *);
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -617,42 +623,51 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
-  while (read_bytes > 0 || zero_bytes > 0) 
+  /* One area covers the whole segment.  The vm_entry of each
+     page is created when the page is first touched. */
+  struct vm_area *area = vma_create (upage, upage + read_bytes + zero_bytes,
+                                     VM_BIN, writable, file, ofs, read_bytes);
+  if (area == NULL)
+    return false;
+  if (!vma_insert (&thread_current ()->vmas, area))
+  {
+    free (area);
+    return false;
+  }
+  if (large_user_pages && writable && zero_bytes >= LARGE_PGSIZE)
+    map_large_pages (area);
+  return true;
+}
+
+/* Maps each 4 MB aligned chunk that lies wholly in the zeroed
+   tail of AREA, typically a big BSS, with one 4 MB page.  The
+   chunks stay resident until the process exits, so this is only
+   done while aligned physical memory is at hand; the rest of the
+   area is paged normally. */
+static void
+map_large_pages (struct vm_area *area)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  uint8_t *chunk = (uint8_t *) ROUND_UP ((uintptr_t) area->start
+                                         + area->read_bytes, LARGE_PGSIZE);
+  size_t n = pd_no ((uint8_t *) area->end - 1) - pd_no (area->start) + 1;
+
+  for (; chunk + LARGE_PGSIZE <= (uint8_t *) area->end; chunk += LARGE_PGSIZE)
+  {
+    void *kpage = palloc_get_aligned (PAL_USER | PAL_ZERO, LARGE_PGPAGES,
+                                      LARGE_PGPAGES);
+    if (kpage == NULL)
+      return;
+    if (area->large == NULL)
+      area->large = calloc (n, sizeof *area->large);
+    if (area->large == NULL
+        || !pagedir_set_large_page (pd, chunk, kpage, area->writable))
     {
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Erase physical memory allocation and mapping codes.
-         Add vm_entry codes. */
-      struct vm_entry *vme = (struct vm_entry *) malloc (sizeof (struct vm_entry));
-      if (vme == NULL)
-        return false;
-      vme->type = VM_BIN;
-      vme->vaddr = upage;
-      vme->writable = writable;
-      vme->is_loaded = false;
-      vme->file = file;
-      vme->offset = ofs;
-      vme->read_bytes = page_read_bytes;
-      vme->zero_bytes = page_zero_bytes;
-
-      /* Insert vm_entry to hash table. */
-      if (!insert_vme (&thread_current ()->vm, vme))
-        return false;
-
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      upage += PGSIZE;
-
-      /* Added code*/
-      ofs += page_read_bytes;
+      palloc_free_multiple (kpage, LARGE_PGPAGES);
+      return;
     }
-  return true;
+    area->large[pd_no (chunk) - pd_no (area->start)] = kpage;
+  }
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -664,30 +679,33 @@ setup_stack (void **esp)
   bool success = false;
 
   struct page *page = alloc_page (PAL_USER | PAL_ZERO);
-  kpage = page->kaddr;
-  if (kpage != NULL) 
+  if (page != NULL) 
     {
+      kpage = page->kaddr;
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
       if (success)
       {
         *esp = PHYS_BASE;
 
-        /* Create and initialize vm_entry. */
-        struct vm_entry *vme = (struct vm_entry *) malloc (sizeof (struct vm_entry));
+        /* The stack is an anonymous area that expand_stack ()
+           grows downward. */
+        struct vm_area *area = vma_create (((uint8_t *) PHYS_BASE) - PGSIZE,
+                                           PHYS_BASE, VM_ANON, true,
+                                           NULL, 0, 0);
+        struct vm_entry *vme = NULL;
+        if (area == NULL || !vma_insert (&thread_current ()->vmas, area))
+          free (area);
+        else
+          vme = find_vme (area->start);
         if (vme == NULL)
         {
           //palloc_free_page (kpage);
           free_page (page->kaddr);
           return false;
         }
-        vme->type = VM_BIN;
-        vme->vaddr = ((uint8_t *) PHYS_BASE) - PGSIZE;
-        vme->writable = true;
         vme->is_loaded = true;
-
-        /* Insert vm_entry to hash table. */
-        insert_vme (&thread_current ()->vm, vme);
         page->vme = vme;
+        unpin_page (page);
       }
       else
         //palloc_free_page (kpage);
@@ -717,16 +735,45 @@ install_page (void *upage, void *kpage, bool writable)
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
 
+/* WRITE is true if the faulting access was a write. */
 bool
-handle_mm_fault (struct vm_entry *vme)
+handle_mm_fault (struct vm_entry *vme, bool write)
 {
   bool success = false;
+  struct thread *t = thread_current ();
 
+  /* Let an eviction of the page finish.  If it failed, the page
+     is mapped again. */
+  lock_acquire (&lru_list_lock);
+  wait_page_io (vme);
+  lock_release (&lru_list_lock);
   if (vme->is_loaded)
-    return false;
+    return pagedir_get_page (t->pagedir, vme->vaddr) != NULL;
+
+  t->fault_cnt++;
+  if (vme->read_bytes > 0 || (vme->type == VM_ANON
+                              && vme->swap_slot != SWAP_ERROR))
+    t->major_fault_cnt++;
+  ws_sample ();
+
+  /* Reading a zero-fill page maps the shared zero frame read-only.
+     The first write gets a private frame in unshare_zero_page (). */
+  if (!write && ((vme->type == VM_BIN && vme->read_bytes == 0)
+                 || (vme->type == VM_ANON && vme->swap_slot == SWAP_ERROR)))
+  {
+    if (!install_page (vme->vaddr, get_zero_frame (), false))
+      return false;
+    vme->is_loaded = true;
+    return true;
+  }
 
+  /* A page that was never swapped out starts as zeros, which the
+     page allocator may have ready. */
+  bool zero_fill = vme->type == VM_ANON && vme->swap_slot == SWAP_ERROR;
   //char *kpage = palloc_get_page (PAL_USER);
-  struct page *page = alloc_page (PAL_USER);
+  struct page *page = alloc_page (PAL_USER | (zero_fill ? PAL_ZERO : 0));
+  if (page == NULL)
+    return false;
   char *kaddr = page->kaddr;
   page->vme = vme;
   switch (vme->type)
@@ -744,14 +791,31 @@ handle_mm_fault (struct vm_entry *vme)
         //printf ("CASE VM_FILE\n");
         if (load_file (kaddr, vme))
           success = install_page (vme->vaddr, kaddr, vme->writable);
+        if (success)
+          mmap_fault_around (vme);
         break;
       }
 
     case VM_ANON :
       {
         //printf ("CASE VM_ANON\n");
-        swap_in (vme->swap_slot, kaddr);
+        size_t slot = vme->swap_slot;
+        /* Never swapped out : a fresh zero-filled page. */
+        if (slot == SWAP_ERROR)
+        {
+          success = install_page (vme->vaddr, kaddr, vme->writable);
+          break;
+        }
+        /* The slot keeps the only other copy of the page until
+           the page is mapped. */
+        swap_in (slot, kaddr);
         success = install_page (vme->vaddr, kaddr, vme->writable);
+        if (success)
+        {
+          swap_free (slot);
+          vme->swap_slot = SWAP_ERROR;
+          swap_read_ahead (vme->vaddr, slot);
+        }
         break;
       }
     default :
@@ -763,44 +827,150 @@ handle_mm_fault (struct vm_entry *vme)
 
   //printf ("handle-mm-fault Result : %s\n", success ? "true" : "false");
   if (!success)
+  {
     //palloc_free_page (kaddr);
     free_page (kaddr);
+    return false;
+  }
 
   vme->is_loaded = true;
-  return success;
+  unpin_page (page);
+  return true;
 }
 
+/* Loads the VM_FILE page of VME into a free frame, if there is
+   one, without evicting anything.  Returns false if no frame is
+   free or the page cannot be read. */
 bool
-expand_stack (void *addr, void *esp)
+prefault_page (struct vm_entry *vme)
 {
-  void *uaddr = pg_round_down (addr);
-  while (!find_vme (uaddr))
-  {
-  /* Allocate page. */
-  struct page *page = alloc_page (PAL_USER);
-  /* Demand paging. */
-  struct vm_entry *vme = (struct vm_entry *) malloc (sizeof (struct vm_entry));
-  if (vme == NULL)
+  struct page *page;
+
+  if (vme->is_loaded)
+    return true;
+  if (vme->type != VM_FILE || vme->busy)
+    return false;
+
+  page = try_alloc_page (PAL_USER);
+  if (page == NULL)
     return false;
-  /* Initialize. */
   page->vme = vme;
-  vme->type = VM_ANON;
-  vme->vaddr = uaddr;
-  vme->writable = true;
-  vme->is_loaded = true;
-  /* Insert vm_entry to hash table. */
-  insert_vme (&thread_current ()->vm, vme);
-  /* Install page. */
-  bool success = install_page (vme->vaddr, page->kaddr, true);
-  if (!success)
+
+  if (!load_file (page->kaddr, vme)
+      || !install_page (vme->vaddr, page->kaddr, vme->writable))
   {
-    delete_vme (&thread_current ()->vm, vme);
-    free_page (page);
-    free (vme);
+    free_page (page->kaddr);
     return false;
   }
-  uaddr += PGSIZE;
+  vme->is_loaded = true;
+  unpin_page (page);
+  return true;
+}
+
+/* After a fault on mapped file page VME, also map the pages that
+   follow it, as many as the madvise () advice of its area asks
+   for. */
+static void
+mmap_fault_around (struct vm_entry *vme)
+{
+  struct vm_area *area = vma_find (&thread_current ()->vmas, vme->vaddr);
+  size_t window, i;
+
+  if (area == NULL || area->advice == MADV_RANDOM)
+    return;
+  window = area->advice == MADV_SEQUENTIAL ? MMAP_READ_AHEAD_PAGES
+                                           : MMAP_FAULT_AROUND_PAGES;
+
+  for (i = 1; i <= window; i++)
+  {
+    uint8_t *upage = (uint8_t *) vme->vaddr + i * PGSIZE;
+    struct vm_entry *next;
+
+    if (upage >= (uint8_t *) area->end)
+      break;
+    next = find_vme (upage);
+    if (next == NULL || !prefault_page (next))
+      break;
+  }
+}
+
+/* Replaces the shared zero frame mapped at VME with a private,
+   writable frame of zeros.  Returns false if VME is null, is not
+   mapped to the zero frame or no frame can be allocated. */
+bool
+unshare_zero_page (struct vm_entry *vme)
+{
+  struct thread *t = thread_current ();
+  struct page *page;
+
+  if (vme == NULL || !vme->is_loaded || !vme->writable
+      || pagedir_get_page (t->pagedir, vme->vaddr) != get_zero_frame ())
+    return false;
+
+  page = alloc_page (PAL_USER | PAL_ZERO);
+  if (page == NULL)
+    return false;
+  page->vme = vme;
+
+  pagedir_clear_page (t->pagedir, vme->vaddr);
+  if (!install_page (vme->vaddr, page->kaddr, true))
+  {
+    free_page (page->kaddr);
+    vme->is_loaded = false;
+    return false;
   }
+  unpin_page (page);
   return true;
 }
 
+/* Swap in the pages following UADDR which were swapped out in
+   the same cluster as UADDR, i.e. whose slots follow SLOT.
+   Only free frames are used, read-ahead never evicts. */
+static void
+swap_read_ahead (void *uaddr, size_t slot)
+{
+  int i;
+  for (i = 1; i <= SWAP_READ_AHEAD; i++)
+  {
+    struct vm_entry *vme = find_vme (uaddr + i * PGSIZE);
+    if (vme == NULL || vme->is_loaded || vme->busy || vme->type != VM_ANON
+        || vme->swap_slot != slot + i)
+      break;
+
+    struct page *page = try_alloc_page (PAL_USER);
+    if (page == NULL)
+      break;
+    page->vme = vme;
+
+    swap_in (vme->swap_slot, page->kaddr);
+    if (!install_page (vme->vaddr, page->kaddr, vme->writable))
+    {
+      free_page (page->kaddr);
+      break;
+    }
+    swap_free (vme->swap_slot);
+    vme->swap_slot = SWAP_ERROR;
+    vme->is_loaded = true;
+    unpin_page (page);
+  }
+}
+
+bool
+expand_stack (void *addr, void *esp)
+{
+  struct thread *t = thread_current ();
+  struct vm_area *stack = vma_find (&t->vmas, (uint8_t *) PHYS_BASE - 1);
+  void *uaddr = pg_round_down (addr);
+  struct vm_entry *vme;
+
+  /* Grow the stack area down to ADDR.  Pages in between are
+     zero-filled when they are first touched. */
+  if (stack == NULL || uaddr >= stack->start
+      || vma_overlaps (&t->vmas, uaddr, stack->start))
+    return false;
+  stack->start = uaddr;
+
+  vme = find_vme (uaddr);
+  return vme != NULL && handle_mm_fault (vme, true);
+}
+
@@ -13,7 +13,9 @@ void remove_child_process (struct thread *);
 int process_add_file (struct file *);
 struct file *process_get_file (int);
 void process_close_file (int);
-bool handle_mm_fault (struct vm_entry *);
+bool handle_mm_fault (struct vm_entry *, bool write);
+bool unshare_zero_page (struct vm_entry *);
+bool prefault_page (struct vm_entry *);
 bool expand_stack (void *, void *);
 
 #endif /* userprog/process.h */
@@ -4,6 +4,7 @@
 #include "userprog/exception.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "filesys/inode.h"
@@ -15,6 +16,7 @@
 #include <debug.h>
 #include <syscall-nr.h>
 #include <string.h>
+#include <round.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -27,12 +29,16 @@ void do_munmap (struct mmap_file *mmap_file);
 int get_mapid (void);
 bool syscall_readdir (int fd, char *name);
 
+/* Cache of struct mmap_file. */
+static struct kmem_cache *mmap_file_cache;
+
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init (&filesys_lock);
+  mmap_file_cache = kmem_cache_create ("mmap_file",
+                                       sizeof (struct mmap_file), NULL);
 }
 
 static void
@@ -78,6 +84,7 @@ syscall_handler (struct intr_frame *f)
 
         /* Create thread, load, execute child process. */
         retval = tid = process_execute (cmd_line);
+        unpin_string (cmd_line);
         t_child = find_child (tid);
         sema_down (&t_child->sema_load);
 
@@ -120,6 +127,7 @@ syscall_handler (struct intr_frame *f)
           syscall_exit (-1);
 
         f->eax = filesys_create (name, initial_size);
+        unpin_string (name);
         break;
       }
 
@@ -135,9 +143,8 @@ syscall_handler (struct intr_frame *f)
         /* Check each pointer have valid address. */
         check_valid_string ((void *)name, f->esp);
 
-        lock_acquire (&filesys_lock);
         f->eax = filesys_remove (name);
-        lock_release (&filesys_lock);
+        unpin_string (name);
         break;
       }
 
@@ -156,10 +163,9 @@ syscall_handler (struct intr_frame *f)
           f->eax = -1;
           break;
         }
-        lock_acquire (&filesys_lock);
         file = filesys_open (name);
         f->eax = process_add_file (file);
-        lock_release (&filesys_lock);
+        unpin_string (name);
         break;
       }
 
@@ -194,6 +200,7 @@ syscall_handler (struct intr_frame *f)
         check_valid_buffer (buffer, size, f->esp, true);
 
         f->eax = syscall_read (fd, buffer, size);
+        unpin_buffer (buffer, size);
         break;
       }
 
@@ -214,6 +221,7 @@ syscall_handler (struct intr_frame *f)
         //check_valid_string (buffer, f->esp);
         
         f->eax = syscall_write (fd, buffer, size);
+        unpin_buffer (buffer, size);
         break;
       }
       
@@ -280,6 +288,21 @@ syscall_handler (struct intr_frame *f)
         break;
       }
 
+    case SYS_MSYNC :
+      {
+        syscall_get_args (f->esp, args, 2);
+        f->eax = syscall_msync ((void *) args[0], (size_t) args[1]);
+        break;
+      }
+
+    case SYS_MADVISE :
+      {
+        syscall_get_args (f->esp, args, 3);
+        f->eax = syscall_madvise ((void *) args[0], (size_t) args[1],
+                                  args[2]);
+        break;
+      }
+
     case SYS_ISDIR :
       {
         int fd;
@@ -394,7 +417,6 @@ syscall_read (int fd, void *buffer, unsigned size)
   int i, retval = 0;
   struct file *file;
   file = process_get_file (fd);
-  lock_acquire (&filesys_lock);
   if (fd == 0)
   {
     retval = 0;
@@ -410,8 +432,6 @@ syscall_read (int fd, void *buffer, unsigned size)
     retval = -1;
   else
     retval = file_read (file, buffer, size);
-    
-  lock_release (&filesys_lock);
 
   return retval;
 }
@@ -422,7 +442,6 @@ syscall_write (int fd, void *buffer, unsigned size)
   int retval;
   struct file *file;
   file = process_get_file (fd);
-  lock_acquire (&filesys_lock);
 
   if (fd == 1)
   {
@@ -436,7 +455,6 @@ syscall_write (int fd, void *buffer, unsigned size)
     retval = file_write (file, buffer, size);
   else
     retval = -1;
-  lock_release (&filesys_lock);
   return retval;
 }
 
@@ -458,92 +476,223 @@ syscall_mmap (int fd, void *addr)
   if (file == NULL)
     return -1;
 
-  struct mmap_file *mmap_file = (struct mmap_file *)malloc (sizeof (struct mmap_file));
+  struct mmap_file *mmap_file = kmem_cache_alloc (mmap_file_cache);
   if (mmap_file == NULL)
     return -1;
 
+  /* One area covers the whole file.  Its pages get vm_entries
+     only when touched. */
+  uint32_t length = file_length (file);
+  struct vm_area *area = NULL;
+  if (length > 0)
+  {
+    void *end = (uint8_t *) addr + ROUND_UP (length, PGSIZE);
+    if (end > PHYS_BASE || end < addr)
+      goto fail;
+    area = vma_create (addr, end, VM_FILE, true, file, 0, length);
+    if (area == NULL)
+      goto fail;
+    if (!vma_insert (&thread_current ()->vmas, area))
+    {
+      free (area);
+      goto fail;
+    }
+  }
+
   /* Initialize. */
   mapid_t mapid = get_mapid ();  /* Supplement. */
   mmap_file->mapid = mapid;
   mmap_file->file = file;
-  list_init (&mmap_file->vme_list);
+  mmap_file->area = area;
 
-  /* Demand paging. */
-  int32_t ofs = 0;
-  uint32_t read_bytes = file_length (file);
-  while (read_bytes > 0) 
-    {
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Erase physical memory allocation and mapping codes.
-         Add vm_entry codes. */
-      struct vm_entry *vme = (struct vm_entry *) malloc (sizeof (struct vm_entry));
-      if (vme == NULL)
-        return -1;
-      vme->type = VM_FILE;
-      vme->vaddr = addr;
-      vme->writable = true;
-      vme->is_loaded = false;
-      vme->file = file;
-      vme->offset = ofs;            /* Which value is needed? */
-      vme->read_bytes = page_read_bytes;
-      vme->zero_bytes = page_zero_bytes;
+  /* Add element to mmap_list. */
+  list_push_back (&thread_current ()->mmap_list, &mmap_file->elem);
 
-      /* Insert vm_entry to hash table page entry. */
-      if (!insert_vme (&thread_current ()->vm, vme))
-      {
-        do_munmap (mmap_file);      /* Must add unmap codes later. */
-        free (mmap_file);
-        return -1;
-      }
+  return mapid;
 
-      /* Add to vme_list. */
-      list_push_back (&mmap_file->vme_list, &vme->mmap_elem);
+ fail:
+  kmem_cache_free (mmap_file_cache, mmap_file);
+  file_close (file);
+  return -1;
+}
 
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      addr += PGSIZE;           
-      ofs += page_read_bytes;
-    }
+/* Writes mapped file page VME back to its file if it is dirty.
+   The frame is pinned meanwhile, so eviction cannot free it.  An
+   eviction already under way writes the page itself. */
+static void
+mmap_writeback (struct vm_entry *vme)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  struct page *page;
+
+  lock_acquire (&lru_list_lock);
+  wait_page_io (vme);
+  page = vme->is_loaded ? find_page (pagedir_get_page (pd, vme->vaddr))
+                        : NULL;
+  if (page != NULL)
+    page->pinned = true;
+  lock_release (&lru_list_lock);
+  if (page == NULL)
+    return;
 
-  /* Add element to mmap_list. */
-  list_push_back (&thread_current ()->mmap_list, &mmap_file->elem);
+  if (pagedir_is_dirty (pd, vme->vaddr))
+  {
+    /* Clear first, a write during the copy makes it dirty again. */
+    pagedir_set_dirty (pd, vme->vaddr, false);
+    file_write_at (vme->file, page->kaddr, vme->read_bytes, vme->offset);
+  }
 
-  return mapid;
+  lock_acquire (&lru_list_lock);
+  page->pinned = false;
+  lock_release (&lru_list_lock);
+}
+
+/* Returns the file mapping area that holds all of [ADDR, ADDR +
+   LENGTH), or NULL. */
+static struct vm_area *
+mmap_find_area (void *addr, size_t length)
+{
+  struct vm_area *area;
+
+  if (pg_ofs (addr) != 0 || length == 0
+      || (uint8_t *) addr + length < (uint8_t *) addr)
+    return NULL;
+  area = vma_find (&thread_current ()->vmas, addr);
+  if (area == NULL || area->type != VM_FILE
+      || (uint8_t *) addr + length > (uint8_t *) area->end)
+    return NULL;
+  return area;
+}
+
+/* Writes the dirty pages of the mapping range [ADDR, ADDR +
+   LENGTH) back to the file.  Only touched pages have a vm_entry,
+   so only those are looked at.  Returns 0, or -1 if the range is
+   not inside one mapping. */
+int
+syscall_msync (void *addr, size_t length)
+{
+  struct vm_area *area = mmap_find_area (addr, length);
+  struct list_elem *e;
+
+  if (area == NULL)
+    return -1;
+  for (e = list_begin (&area->vme_list); e != list_end (&area->vme_list);
+       e = list_next (e))
+  {
+    struct vm_entry *vme = list_entry (e, struct vm_entry, area_elem);
+    if (vme->vaddr >= addr && (uint8_t *) vme->vaddr < (uint8_t *) addr + length)
+      mmap_writeback (vme);
+  }
+  return 0;
+}
+
+/* Applies ADVICE to the mapping range [ADDR, ADDR + LENGTH).
+   MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL set how many
+   pages a fault maps and apply to the whole mapping.
+   MADV_WILLNEED maps the range now, as far as free frames go,
+   without evicting other pages.  MADV_DONTNEED writes dirty pages
+   back and frees their frames.  Returns 0, or -1 on a bad range
+   or advice. */
+int
+syscall_madvise (void *addr, size_t length, int advice)
+{
+  struct thread *t = thread_current ();
+  struct vm_area *area = mmap_find_area (addr, length);
+  uint8_t *upage, *end = (uint8_t *) addr + length;
+  struct list_elem *e;
+
+  if (area == NULL)
+    return -1;
+
+  switch (advice)
+  {
+    case MADV_NORMAL :
+    case MADV_RANDOM :
+    case MADV_SEQUENTIAL :
+      area->advice = advice;
+      return 0;
+
+    case MADV_WILLNEED :
+      for (upage = addr; upage < end; upage += PGSIZE)
+      {
+        struct vm_entry *vme = find_vme (upage);
+        if (vme == NULL || !prefault_page (vme))
+          break;
+      }
+      return 0;
+
+    case MADV_DONTNEED :
+      for (e = list_begin (&area->vme_list); e != list_end (&area->vme_list);
+           e = list_next (e))
+      {
+        struct vm_entry *vme = list_entry (e, struct vm_entry, area_elem);
+        struct page *page;
+
+        if (vme->vaddr < addr || (uint8_t *) vme->vaddr >= end)
+          continue;
+        mmap_writeback (vme);
+
+        lock_acquire (&lru_list_lock);
+        wait_page_io (vme);
+        page = vme->is_loaded ? find_page (pagedir_get_page (t->pagedir,
+                                                             vme->vaddr))
+                              : NULL;
+        if (page != NULL && !page->pinned)
+        {
+          vme->is_loaded = false;
+          __free_page (page);
+        }
+        lock_release (&lru_list_lock);
+      }
+      return 0;
+
+    default :
+      return -1;
+  }
 }
 
 /* Remove every vm_entry related to vme_list. */
 void
 do_munmap (struct mmap_file *mmap_file)
 {
-  struct list_elem *e = list_begin (&mmap_file->vme_list);
-  while (!list_empty (&mmap_file->vme_list))
+  struct thread *t = thread_current ();
+  struct vm_area *area = mmap_file->area;
+
+  if (area == NULL)
+    return;
+
+  /* Only pages that were touched have a vm_entry. */
+  while (!list_empty (&area->vme_list))
   {
-    struct vm_entry *vme = list_entry (e, struct vm_entry, mmap_elem);
+    struct list_elem *e = list_pop_front (&area->vme_list);
+    struct vm_entry *vme = list_entry (e, struct vm_entry, area_elem);
+    struct page *page;
+
+    mmap_writeback (vme);
+
+    /* Eviction may have taken the page since the write-back.  It
+       writes the page itself then, so only wait for it; otherwise
+       free the frame before eviction can take it. */
+    lock_acquire (&lru_list_lock);
+    wait_page_io (vme);
     if (vme->is_loaded)
     {
-      if (pagedir_is_dirty (thread_current ()->pagedir, vme->vaddr))
-      {
-        lock_acquire (&filesys_lock);
-        file_write_at (vme->file, vme->vaddr, vme->read_bytes, vme->offset);
-        lock_release (&filesys_lock);
-      }
       /* If vme is loaded (physical page is exist), free page. */
       //palloc_free_page (pagedir_get_page (thread_current ()->pagedir, vme->vaddr));
-      free_page (pagedir_get_page (thread_current ()->pagedir, vme->vaddr));
-      pagedir_clear_page (thread_current ()->pagedir, vme->vaddr);
+      page = find_page (pagedir_get_page (t->pagedir, vme->vaddr));
+      if (page != NULL)
+        __free_page (page);
+      pagedir_clear_page (t->pagedir, vme->vaddr);
+      vme->is_loaded = false;
     }
+    lock_release (&lru_list_lock);
 
-    /* Remove vme from vme_list. */
-    e = list_remove (&vme->mmap_elem);
     /* Remove vme from hash table page entry. */
-    delete_vme (&thread_current ()->vm, vme);
+    delete_vme (&t->vm, vme);
+    free_vme (vme);
   }
-  /* Don't free vme because file_close () will free it's file. */
+  vma_remove (&t->vmas, area);
+  mmap_file->area = NULL;
 }
 
 void 
@@ -567,7 +716,7 @@ syscall_munmap (mapid_t mapid)
       e = list_remove (e);
 
       /* Remove mmap_file. */
-      free (mmap_file);
+      kmem_cache_free (mmap_file_cache, mmap_file);
     }
     else
       e = list_next (e);
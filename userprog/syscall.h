@@ -1,12 +1,13 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stddef.h>
+
 #define CLOSE_ALL 0
 
 typedef int mapid_t;
 
 void syscall_init (void);
-struct lock filesys_lock;
 struct vm_entry *check_address (void *, void *);
 
 void syscall_exit (int exit_status);
@@ -14,5 +15,7 @@ int syscall_read (int, void *, unsigned);
 int syscall_write (int, void *, unsigned);
 int syscall_mmap (int fd, void *addr);
 void syscall_munmap (mapid_t);
+int syscall_msync (void *addr, size_t length);
+int syscall_madvise (void *addr, size_t length, int advice);
 
 #endif /* userprog/syscall.h */
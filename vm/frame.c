@@ -1,22 +1,123 @@
 #include "vm/frame.h"
+#include <stdio.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 
 struct list_elem *lru_clock;
+
+/* Number of lru_list pages the page cleaner looks at for dirty
+   file pages per wakeup. */
+#define KSWAPD_CLEAN_SCAN 32
+
+/* Page cleaner.  When fewer than kswapd_low user frames are free
+   it is woken up, evicts cold frames until kswapd_high frames are
+   free, and writes back dirty file pages ahead of the clock, so
+   that a page fault rarely has to reclaim a frame by itself. */
+static size_t kswapd_low, kswapd_high;
+static struct semaphore kswapd_sema;
+static bool kswapd_started;
+static bool kswapd_woken;
+
+/* Statistics. */
+static long long kswapd_wake_cnt;       /* Page cleaner wakeups. */
+static long long kswapd_evict_cnt;      /* Frames freed by it. */
+static long long kswapd_clean_cnt;      /* File pages it cleaned. */
+static long long direct_reclaim_cnt;    /* Faults that had to evict. */
+
+/* Frame table: the struct page of each frame of the user pool,
+   indexed by its position in the pool, so that the page of a
+   frame is found without walking lru_list.  Entries are set
+   while the page is on lru_list, under lru_list_lock. */
+static struct page **frame_table;
+static size_t frame_cnt;
+
+/* Cache of struct page. */
+static struct kmem_cache *page_cache;
+
+/* Resident set limit of each process in frames, 0 for none.
+   While any process is above it, eviction takes frames from
+   such processes first. */
+static size_t rss_limit;
+static size_t over_limit_cnt;           /* Processes above rss_limit. */
+
+/* Print resident set statistics of each process at exit. */
+static bool process_stats;
+
+/* Working set sampling period: the accessed bits of a process's
+   pages are harvested at most this often, on its page faults. */
+#define WS_SAMPLE_TICKS (TIMER_FREQ / 4)
+
+/* Shared read-only frame of zeros, mapped for read faults on
+   zero-fill pages.  Never in lru_list and never freed. */
+static void *zero_frame;
+
+/* Eviction and the page cleaner write frames out without holding
+   lru_list_lock.  The vm_entry of such a frame is marked busy
+   meanwhile, and this is signalled when it stops being busy. */
+static struct condition page_io_cond;
 void *try_to_free_pages (enum palloc_flags flags);
-void __free_page (struct page *page);
 static struct list_elem *get_next_lru_clock (void);
 
+static struct page *make_page (void *kaddr);
+static void wakeup_kswapd (void);
+static void kswapd (void *aux);
+static struct page *select_victim (void);
+static bool is_referenced (struct page *);
+static bool is_swap_backed (struct page *);
+static size_t evict (struct page *, bool wait);
+static size_t evict_swap_cluster (struct page *);
+static bool evict_file_page (struct page *, bool wait);
+static bool isolate_page (struct page *);
+static void restore_page (struct page *, bool dirty);
+static void free_isolated_page (struct page *);
+static void end_page_io (struct vm_entry *);
+
 struct page *
 alloc_page (enum palloc_flags flags)
 {
+  void *kaddr;
+
+  /* Eviction may wait for a file this thread has locked. */
+  ASSERT (!filesys_lock_held ());
+
   /* If palloc_get_page is failed, try to free pages. */
-  void *kaddr = palloc_get_page (flags);
+  kaddr = palloc_get_page (flags);
   if (kaddr == NULL)
+  {
+    direct_reclaim_cnt++;
     kaddr = try_to_free_pages (flags);
-  
+  }
+  wakeup_kswapd ();
+  if (kaddr == NULL)
+    return NULL;
+
+  return make_page (kaddr);
+}
+
+/* Same as alloc_page (), but returns NULL instead of evicting
+   other pages when no free frame is left. Used for read-ahead. */
+struct page *
+try_alloc_page (enum palloc_flags flags)
+{
+  void *kaddr = palloc_get_page (flags);
+  if (kaddr == NULL)
+    return NULL;
+
+  return make_page (kaddr);
+}
+
+/* Wrap frame KADDR into a struct page and add it to lru_list.
+   The page is pinned, so that eviction leaves it alone while the
+   caller fills and maps it, possibly sleeping on I/O; the caller
+   then calls unpin_page (), or free_page () on failure. */
+static struct page *
+make_page (void *kaddr)
+{
   /* Page & Memory allocation. */
-  struct page *page = (struct page *)malloc (sizeof (struct page));
+  struct page *page = kmem_cache_alloc (page_cache);
   if (page == NULL)
   {
     palloc_free_page (kaddr);
@@ -27,6 +128,7 @@ alloc_page (enum palloc_flags flags)
   page->kaddr = kaddr;
   page->vme = NULL;
   page->thread = thread_current ();
+  page->pinned = true;
 
   /* Insertion. */
   lock_acquire (&lru_list_lock);
@@ -36,11 +138,22 @@ alloc_page (enum palloc_flags flags)
   return page;
 }
 
+/* Unpins PAGE, returned pinned by alloc_page () or
+   try_alloc_page (), once it is mapped and its vm_entry loaded. */
+void
+unpin_page (struct page *page)
+{
+  lock_acquire (&lru_list_lock);
+  page->pinned = false;
+  lock_release (&lru_list_lock);
+}
+
 void
 lru_list_init (void)
 {
   list_init (&lru_list);
   lock_init (&lru_list_lock);
+  cond_init (&page_io_cond);
   /* Set lru_clock value to NULL. */
   /* !ERROR CODE! 
      lru_list is empty list now, so there is no element in list. 
@@ -48,18 +161,231 @@ lru_list_init (void)
      so try_to_free_pages cannot make it's entry.*/
   //lru_clock = list_begin (&lru_list);
   lru_clock = NULL;
+
+  page_cache = kmem_cache_create ("page", sizeof (struct page), NULL);
+
+  frame_cnt = palloc_page_cnt (PAL_USER);
+  frame_table = calloc (frame_cnt, sizeof *frame_table);
+  if (frame_table == NULL)
+    PANIC ("lru_list_init: cannot allocate frame table");
+
+  zero_frame = palloc_get_page (PAL_ZERO);
+  if (zero_frame == NULL)
+    PANIC ("lru_list_init: cannot allocate zero frame");
+}
+
+/* Starts the page cleaner.  The watermarks scale with the size
+   of the user pool. */
+void
+kswapd_init (void)
+{
+  kswapd_low = palloc_page_cnt (PAL_USER) / 32;
+  if (kswapd_low < 4)
+    kswapd_low = 4;
+  kswapd_high = 2 * kswapd_low;
+
+  sema_init (&kswapd_sema, 0);
+  if (thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL) == TID_ERROR)
+    PANIC ("kswapd_init: cannot start page cleaner");
+  kswapd_started = true;
+}
+
+/* Wakes up the page cleaner if free frames ran low. */
+static void
+wakeup_kswapd (void)
+{
+  if (!kswapd_started || kswapd_woken
+      || palloc_free_cnt (PAL_USER) >= kswapd_low)
+    return;
+  kswapd_woken = true;
+  sema_up (&kswapd_sema);
+}
+
+/* Write back up to KSWAPD_CLEAN_SCAN dirty file pages ahead of
+   lru_clock, without waiting for files in use.  The pages stay
+   mapped, being busy only keeps them from being evicted or freed
+   while they are written without lru_list_lock. */
+static void
+kswapd_clean (void)
+{
+  struct page *pages[KSWAPD_CLEAN_SCAN];
+  struct list_elem *e;
+  size_t scan, cnt = 0, i;
+
+  lock_acquire (&lru_list_lock);
+  e = lru_clock;
+  for (scan = 0; scan < KSWAPD_CLEAN_SCAN && !list_empty (&lru_list); scan++)
+  {
+    if (e == NULL || e == list_end (&lru_list))
+      e = list_begin (&lru_list);
+    struct page *page = list_entry (e, struct page, lru);
+    e = list_next (e);
+
+    if (page->vme == NULL || page->vme->busy || page->vme->type != VM_FILE
+        || !pagedir_is_dirty (page->thread->pagedir, page->vme->vaddr))
+      continue;
+    /* Clear the dirty bit first, so that a write racing with the
+       write-back marks the page dirty again. */
+    pagedir_set_dirty (page->thread->pagedir, page->vme->vaddr, false);
+    page->vme->busy = true;
+    pages[cnt++] = page;
+  }
+  lock_release (&lru_list_lock);
+
+  for (i = 0; i < cnt; i++)
+  {
+    struct page *page = pages[i];
+    if (file_try_write_at (page->vme->file, page->kaddr,
+                           page->vme->read_bytes, page->vme->offset) < 0)
+      pagedir_set_dirty (page->thread->pagedir, page->vme->vaddr, true);
+    else
+      kswapd_clean_cnt++;
+  }
+
+  lock_acquire (&lru_list_lock);
+  for (i = 0; i < cnt; i++)
+    end_page_io (pages[i]->vme);
+  lock_release (&lru_list_lock);
+}
+
+/* Page cleaner thread. */
+static void
+kswapd (void *aux UNUSED)
+{
+  for (;;)
+  {
+    size_t failed = 0;
+
+    sema_down (&kswapd_sema);
+    kswapd_wake_cnt++;
+
+    lock_acquire (&lru_list_lock);
+    while (palloc_free_cnt (PAL_USER) < kswapd_high)
+    {
+      struct page *page = select_victim ();
+      size_t freed;
+
+      if (page == NULL)
+        break;
+      freed = evict (page, false);
+      if (freed > 0)
+        kswapd_evict_cnt += freed;
+      else if (++failed > list_size (&lru_list))
+        break;
+    }
+    lock_release (&lru_list_lock);
+    kswapd_clean ();
+
+    kswapd_woken = false;
+  }
+}
+
+/* Prints frame reclaim statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu of %zu free, direct reclaim %lld times\n",
+          palloc_free_cnt (PAL_USER), palloc_page_cnt (PAL_USER),
+          direct_reclaim_cnt);
+  printf ("Kswapd: woken %lld times, %lld frames freed, "
+          "%lld file pages cleaned\n",
+          kswapd_wake_cnt, kswapd_evict_cnt, kswapd_clean_cnt);
+}
+
+/* Returns the shared zero frame. */
+void *
+get_zero_frame (void)
+{
+  return zero_frame;
 }
 
+/* Adds PAGE to lru_list and charges it to its owner's RSS. */
 void 
 add_page_to_lru_list (struct page *page)
 {
+  struct thread *t = page->thread;
+
   list_push_back (&lru_list, &page->lru);
+  frame_table[palloc_page_idx (PAL_USER, page->kaddr)] = page;
+  if (++t->rss > t->rss_peak)
+    t->rss_peak = t->rss;
+  if (rss_limit != 0 && t->rss == rss_limit + 1)
+    over_limit_cnt++;
 }
 
 void 
 del_page_to_lru_list (struct page *page)
 {
+  struct thread *t = page->thread;
+
   list_remove (&page->lru);
+  frame_table[palloc_page_idx (PAL_USER, page->kaddr)] = NULL;
+  if (rss_limit != 0 && t->rss == rss_limit + 1)
+    over_limit_cnt--;
+  t->rss--;
+}
+
+/* Limits the resident set of every process to PAGE_CNT frames,
+   0 for no limit.  Must be called before any process runs. */
+void
+frame_set_rss_limit (size_t page_cnt)
+{
+  rss_limit = page_cnt;
+}
+
+/* Makes process_exit () print resident set statistics. */
+void
+frame_enable_process_stats (void)
+{
+  process_stats = true;
+}
+
+/* Estimates the working set of the current process from the
+   accessed bits of its resident pages, if WS_SAMPLE_TICKS passed
+   since the last sample.  The accessed bits are moved into
+   vm_entry->referenced, so the clock still sees them. */
+void
+ws_sample (void)
+{
+  struct thread *t = thread_current ();
+  struct hash_iterator i;
+  size_t referenced = 0;
+
+  if (timer_elapsed (t->ws_sample_tick) < WS_SAMPLE_TICKS)
+    return;
+  t->ws_sample_tick = timer_ticks ();
+
+  lock_acquire (&lru_list_lock);
+  hash_first (&i, &t->vm);
+  while (hash_next (&i))
+  {
+    struct vm_entry *vme = hash_entry (hash_cur (&i), struct vm_entry, elem);
+    if (!vme->is_loaded)
+      continue;
+    if (pagedir_is_accessed (t->pagedir, vme->vaddr))
+    {
+      pagedir_set_accessed (t->pagedir, vme->vaddr, false);
+      vme->referenced = true;
+      referenced++;
+    }
+  }
+  lock_release (&lru_list_lock);
+
+  /* Smooth over the last few samples. */
+  t->wss = (3 * t->wss + referenced + 3) / 4;
+}
+
+/* Prints the resident set statistics of the exiting current
+   process, if "-vmstats" asked for them. */
+void
+frame_print_process_stats (void)
+{
+  struct thread *t = thread_current ();
+
+  if (process_stats)
+    printf ("%s: rss %zu pages (peak %zu), working set %zu pages, "
+            "%lld faults (%lld major)\n", t->name, t->rss, t->rss_peak,
+            t->wss, t->fault_cnt, t->major_fault_cnt);
 }
 
 static struct list_elem *
@@ -73,88 +399,306 @@ get_next_lru_clock (void)
     return lru_clock;
 }
 
-/* No space left, try to free pages and allocate new frame. */ 
-void * 
-try_to_free_pages (enum palloc_flags flags)
+/* True if PAGE was accessed since the clock last passed it.
+   Clears that state, giving the page a second chance. */
+static bool
+is_referenced (struct page *page)
 {
-  void *kaddr = NULL;
-  struct page *page;
-  struct vm_entry *vme;
+  bool referenced = page->vme->referenced;
 
-  while (kaddr == NULL)
+  page->vme->referenced = false;
+  if (pagedir_is_accessed (page->thread->pagedir, page->vme->vaddr))
+  {
+    pagedir_set_accessed (page->thread->pagedir, page->vme->vaddr, false);
+    referenced = true;
+  }
+  return referenced;
+}
+
+/* Pick the next victim with the clock algorithm. Recently
+   accessed pages get a second chance.  While some process is
+   over its RSS limit, the first two sweeps consider only the
+   pages of such processes. Returns NULL if no page could be
+   selected within two sweeps of lru_list. */
+static struct page *
+select_victim (void)
+{
+  size_t size = list_size (&lru_list);
+  size_t scan = (over_limit_cnt > 0 ? 4 : 2) * size;
+
+  while (scan-- > 0)
   {
     /* If lru_clock indicates NULL, then change it to begin of lru_list. */
     if (lru_clock == NULL)
       lru_clock = list_begin (&lru_list);
 
-    /* Get page and vm_entry. */
-    page = list_entry (lru_clock, struct page, lru);
-    vme = page->vme;
+    struct page *page = list_entry (lru_clock, struct page, lru);
 
     /* You must move lru_clock becasue selected page may be free. */
     lru_clock = get_next_lru_clock ();
 
-    lock_acquire (&lru_list_lock);
+    /* Page is still being set up by the caller of alloc_page (),
+       or a system call is using it. */
+    if (page->vme == NULL || page->pinned || page->vme->busy)
+      continue;
+
+    /* Spare processes within their limit while others are over. */
+    if (scan >= 2 * size && page->thread->rss <= rss_limit)
+      continue;
 
     /* Check pagedir_is_accessed. */
-    if (pagedir_is_accessed (page->thread->pagedir, page->vme->vaddr))
-      pagedir_set_accessed (page->thread->pagedir, page->vme->vaddr, false);
+    if (is_referenced (page))
+      continue;
+
+    return page;
+  }
+
+  return NULL;
+}
+
+/* True if PAGE is written to the swap partition on eviction. */
+static bool
+is_swap_backed (struct page *page)
+{
+  return page->vme->type == VM_BIN || page->vme->type == VM_ANON;
+}
+
+/* Order of pages inside a swap cluster : by owner, then by
+   virtual address, so that neighbouring pages of a process get
+   neighbouring swap slots. */
+static bool
+cluster_less (struct page *a, struct page *b)
+{
+  if (a->thread != b->thread)
+    return a->thread < b->thread;
+  return a->vme->vaddr < b->vme->vaddr;
+}
+
+/* Evicts PAGE, and with a swap-backed PAGE other cold pages near
+   it.  Returns the number of frames freed, 0 if PAGE could not be
+   evicted.  lru_list_lock must be held, it is released during the
+   I/O. */
+static size_t
+evict (struct page *page, bool wait)
+{
+  if (is_swap_backed (page))
+    return evict_swap_cluster (page);
+  return evict_file_page (page, wait) ? 1 : 0;
+}
 
-    /* Victim eviction. */
-    switch (page->vme->type)
+/* Evict VICTIM together with up to SWAP_CLUSTER_PAGES - 1 other
+   cold swap-backed pages found ahead of lru_clock, writing all
+   of them with one swap_out_cluster () call.
+   Returns the number of pages evicted, 0 if swap is full. */
+static size_t
+evict_swap_cluster (struct page *victim)
+{
+  struct page *cluster[SWAP_CLUSTER_PAGES];
+  void *kaddrs[SWAP_CLUSTER_PAGES];
+  size_t slots[SWAP_CLUSTER_PAGES];
+  bool dirty[SWAP_CLUSTER_PAGES];
+  size_t cnt = 0, scan, i, j;
+  bool success;
+
+  cluster[cnt++] = victim;
+
+  /* Collect more victims, but don't sweep the whole list. */
+  for (scan = 2 * SWAP_CLUSTER_PAGES;
+       scan > 0 && cnt < SWAP_CLUSTER_PAGES && lru_clock != NULL; scan--)
+  {
+    struct page *page = list_entry (lru_clock, struct page, lru);
+    if (page->vme == NULL || page->pinned || page->vme->busy
+        || !is_swap_backed (page))
+      break;
+    if (over_limit_cnt > 0 && page->thread->rss <= rss_limit)
+      break;
+    if (page->vme->referenced
+        || pagedir_is_accessed (page->thread->pagedir, page->vme->vaddr))
+      break;
+    lru_clock = get_next_lru_clock ();
+    cluster[cnt++] = page;
+  }
+
+  /* Insertion sort, the cluster is tiny. */
+  for (i = 1; i < cnt; i++)
+  {
+    struct page *page = cluster[i];
+    for (j = i; j > 0 && cluster_less (page, cluster[j - 1]); j--)
+      cluster[j] = cluster[j - 1];
+    cluster[j] = page;
+  }
+
+  for (i = 0; i < cnt; i++)
+  {
+    kaddrs[i] = cluster[i]->kaddr;
+    dirty[i] = isolate_page (cluster[i]);
+  }
+  lock_release (&lru_list_lock);
+  success = swap_out_cluster (kaddrs, slots, cnt);
+  lock_acquire (&lru_list_lock);
+
+  for (i = 0; i < cnt; i++)
+  {
+    struct vm_entry *vme = cluster[i]->vme;
+    if (success)
     {
-      case VM_BIN :
-        {
-          page->vme->type = VM_ANON;
-          page->vme->swap_slot = swap_out (page->kaddr);
-          break;
-        }
-
-      case VM_FILE :
-        {
-          /* Check pagedir_is_dirty. */
-          if (pagedir_is_dirty (page->thread->pagedir, page->vme->vaddr))
-          {
-            /* Lock must be used at every read/write operation. 
-               Assume that if lock is acquired by other thread,
-               then status of current thread will be changed to THREAD_BLOCK. 
-               If you don't use lock, it will make script confused. 
-               (lock_held_by_current_thread () script error will cause.)  */
-            lock_acquire (&filesys_lock);
-            file_write_at (vme->file, vme->vaddr, vme->read_bytes, vme->offset);
-            pagedir_set_dirty (page->thread->pagedir, vme->vaddr, false);
-            lock_release (&filesys_lock);
-          } 
-          /* Do not swap it out. Just write it and free. */
-          //page->vme->type = VM_ANON;
-          //page->vme->swap_slot = swap_out (page->kaddr);
-          break;
-        }
-  
-      case VM_ANON :
-        {
-          /* Always write at swap partition. */
-          page->vme->swap_slot = swap_out (page->kaddr);
-          break;
-        }
+      /* Always write at swap partition. */
+      vme->type = VM_ANON;
+      vme->swap_slot = slots[i];
+      free_isolated_page (cluster[i]);
     }
+    else
+      restore_page (cluster[i], dirty[i]);
+    end_page_io (vme);
+  }
+  return success ? cnt : 0;
+}
 
-    /* Free page. */
-    page->vme->is_loaded = false;
-    __free_page (page);
+/* Evict VM_FILE page, writing it back to its file if dirty.
+   Do not swap it out, it can be read from the file again.
+   Unless WAIT is true, a dirty page is kept and false returned
+   when its file is being read or written.  The write is done
+   without lru_list_lock, and cannot deadlock on the file's lock
+   since no thread faults or allocates user pages while it holds
+   a file system lock (see filesys.c). */
+static bool
+evict_file_page (struct page *page, bool wait)
+{
+  struct vm_entry *vme = page->vme;
+  bool dirty = isolate_page (page);
+  bool written = true;
+
+  if (dirty)
+  {
+    /* Write through kaddr, the owner's user address is not
+       mapped when the owner is not the current thread. */
+    lock_release (&lru_list_lock);
+    if (wait)
+      file_write_at (vme->file, page->kaddr, vme->read_bytes, vme->offset);
+    else
+      written = file_try_write_at (vme->file, page->kaddr, vme->read_bytes,
+                                   vme->offset) >= 0;
+    lock_acquire (&lru_list_lock);
+  }
+
+  if (written)
+    free_isolated_page (page);
+  else
+    restore_page (page, dirty);
+  end_page_io (vme);
+  return written;
+}
+
+/* Takes PAGE away from its owner so that its frame can be written
+   out without lru_list_lock: removes it from lru_list, unmaps it
+   and marks its vm_entry busy.  A fault on the page waits until
+   the eviction ends.  Returns the page's dirty bit.
+   lru_list_lock must be held. */
+static bool
+isolate_page (struct page *page)
+{
+  struct vm_entry *vme = page->vme;
+  uint32_t *pd = page->thread->pagedir;
+  bool dirty = pagedir_is_dirty (pd, vme->vaddr);
+
+  if (lru_clock == &page->lru)
+    lru_clock = get_next_lru_clock ();
+  del_page_to_lru_list (page);
+  vme->busy = true;
+  vme->is_loaded = false;
+  pagedir_clear_page (pd, vme->vaddr);
+  return dirty;
+}
+
+/* Gives PAGE, taken by isolate_page (), back to its owner after
+   a failed eviction.  lru_list_lock must be held. */
+static void
+restore_page (struct page *page, bool dirty)
+{
+  struct vm_entry *vme = page->vme;
+  uint32_t *pd = page->thread->pagedir;
+
+  /* The page table of the page is still there, so this does not
+     allocate. */
+  if (!pagedir_set_page (pd, vme->vaddr, page->kaddr, vme->writable))
+    PANIC ("restore_page: cannot map page again");
+  pagedir_set_dirty (pd, vme->vaddr, dirty);
+  vme->is_loaded = true;
+  add_page_to_lru_list (page);
+}
+
+/* Frees the frame of PAGE, taken by isolate_page (), after its
+   contents were written out. */
+static void
+free_isolated_page (struct page *page)
+{
+  palloc_free_page (page->kaddr);
+  kmem_cache_free (page_cache, page);
+}
+
+/* Ends the write-out of VME's page and wakes up the threads that
+   wait for it.  lru_list_lock must be held. */
+static void
+end_page_io (struct vm_entry *vme)
+{
+  vme->busy = false;
+  cond_broadcast (&page_io_cond, &lru_list_lock);
+}
+
+/* Waits until the page of VME is not being written out by
+   eviction or the page cleaner.  Must be called before loading,
+   freeing or writing back the page, or destroying VME.
+   lru_list_lock must be held. */
+void
+wait_page_io (struct vm_entry *vme)
+{
+  ASSERT (lock_held_by_current_thread (&lru_list_lock));
+
+  while (vme->busy)
+    cond_wait (&page_io_cond, &lru_list_lock);
+}
+
+/* No space left, try to free pages and allocate new frame. */ 
+void * 
+try_to_free_pages (enum palloc_flags flags)
+{
+  void *kaddr = NULL;
+  struct page *page;
+  size_t failed = 0;
+
+  lock_acquire (&lru_list_lock);
+
+  while (kaddr == NULL)
+  {
+    page = select_victim ();
+    if (page == NULL)
+      break;
+
+    /* Victim eviction. If swap is full, only file pages can go,
+       give up after a whole sweep without success. */
+    if (evict (page, true) == 0)
+    {
+      if (++failed > list_size (&lru_list))
+        break;
+      continue;
+    }
 
     /* Memory allocation and return it's pointer.*/
     kaddr = palloc_get_page (flags);
-
-    lock_release (&lru_list_lock);
   }
 
+  lock_release (&lru_list_lock);
+
   return kaddr;
 }
 
 void
 __free_page (struct page *page)
 {
+  /* Don't leave lru_clock pointing at a removed element. */
+  if (lru_clock == &page->lru)
+    lru_clock = get_next_lru_clock ();
+
   /* List remove. */
   del_page_to_lru_list (page);
   /* Free Physical page. */
@@ -162,7 +706,7 @@ __free_page (struct page *page)
   /* Clear virtual page. */
   pagedir_clear_page (page->thread->pagedir, page->vme->vaddr);
   /* Free struct page. */
-  free (page);
+  kmem_cache_free (page_cache, page);
 
   /* Do not free vme because vm_destroy will be called before exit PintOS. */
 }
@@ -170,18 +714,22 @@ __free_page (struct page *page)
 void 
 free_page (void *kaddr)
 {
-  struct list_elem *e, *tmp;
+  struct page *page;
   lock_acquire (&lru_list_lock);
-  for (e = list_begin (&lru_list); e != list_end (&lru_list);
-       e = tmp)
-  {
-    struct page *page = list_entry (e, struct page, lru);
-    /* Selected list_elem will be removed from lru_list.
-       So just change list_elem before free. */
-    tmp = list_next (e);
-    if (page->kaddr == kaddr)
-      __free_page (page);
-  }
+  page = find_page (kaddr);
+  if (page != NULL)
+    __free_page (page);
   lock_release (&lru_list_lock);
 }
 
+/* Returns the page whose frame is KADDR, or NULL.
+   lru_list_lock must be held. */
+struct page *
+find_page (void *kaddr)
+{
+  size_t idx;
+
+  ASSERT (lock_held_by_current_thread (&lru_list_lock));
+  idx = palloc_page_idx (PAL_USER, kaddr);
+  return idx < frame_cnt ? frame_table[idx] : NULL;
+}
@@ -12,8 +12,20 @@ struct lock lru_list_lock;
 
 void lru_list_init (void);
 struct page *alloc_page (enum palloc_flags flags);
+struct page *try_alloc_page (enum palloc_flags flags);
 void add_page_to_lru_list (struct page *);
 void del_page_to_lru_list (struct page *);
+void unpin_page (struct page *);
 void free_page (void *kaddr);
+struct page *find_page (void *kaddr);
+void __free_page (struct page *);
+void wait_page_io (struct vm_entry *);
+void *get_zero_frame (void);
+void kswapd_init (void);
+void frame_print_stats (void);
+void frame_set_rss_limit (size_t page_cnt);
+void frame_enable_process_stats (void);
+void frame_print_process_stats (void);
+void ws_sample (void);
 
 #endif
@@ -2,6 +2,7 @@
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/flags.h"
 #include "threads/init.h"
@@ -10,8 +11,10 @@
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
 #include "userprog/gdt.h"
+#include "userprog/exception.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "lib/kernel/hash.h"
 #include <string.h>
   
@@ -19,6 +22,24 @@ static unsigned vm_hash_func (const struct hash_elem *e, void *aux UNUSED);
 static bool vm_less_func (const struct hash_elem *a, 
     const struct hash_elem *b, void *aux UNUSED);
 static void vm_destroy_func (struct hash_elem *e, void *aux UNUSED);
+static struct vm_entry *create_vme (struct vm_area *, void *upage);
+
+/* Cache of struct vm_entry. */
+static struct kmem_cache *vme_cache;
+
+/* Creates the vm_entry cache. */
+void
+vme_cache_init (void)
+{
+  vme_cache = kmem_cache_create ("vm_entry", sizeof (struct vm_entry), NULL);
+}
+
+/* Frees VME, which must be out of the hash table already. */
+void
+free_vme (struct vm_entry *vme)
+{
+  kmem_cache_free (vme_cache, vme);
+}
 
 /* Initialize virtual memory. 
    All of the vm_entry are managed by hash table. */
@@ -65,17 +86,55 @@ delete_vme (struct hash *vm, struct vm_entry *vme)
   return (e == NULL ? false : true);
 }
 
-/* Find vm_entry from hash table by using virtual address. */
+/* Find vm_entry from hash table by using virtual address.
+   A page of an area that has not been touched yet gets its
+   vm_entry here. */
 struct vm_entry *
 find_vme (void *vaddr)
 {
+  struct thread *t = thread_current ();
+  struct vm_area *area;
   struct vm_entry vme;
   struct hash_elem *e;
   vme.vaddr = pg_round_down (vaddr);
-  e = hash_find (&thread_current ()->vm, &vme.elem);
-  if (e == NULL)
+  e = hash_find (&t->vm, &vme.elem);
+  if (e != NULL)
+    return hash_entry (e, struct vm_entry, elem);
+
+  area = vma_find (&t->vmas, vme.vaddr);
+  if (area == NULL)
     return NULL;
-  return hash_entry (e, struct vm_entry, elem);
+  return create_vme (area, vme.vaddr);
+}
+
+/* Creates the vm_entry of page UPAGE in AREA. */
+static struct vm_entry *
+create_vme (struct vm_area *area, void *upage)
+{
+  size_t ofs = (uint8_t *) upage - (uint8_t *) area->start;
+  struct vm_entry *vme = kmem_cache_alloc (vme_cache);
+  if (vme == NULL)
+    return NULL;
+
+  vme->type = area->type;
+  vme->vaddr = upage;
+  vme->writable = area->writable;
+  /* A page inside a 4 MB page is always resident. */
+  vme->is_loaded = vma_large_frame (area, upage) != NULL;
+  vme->referenced = false;
+  vme->busy = false;
+  vme->file = area->file;
+  vme->offset = area->offset + ofs;
+  vme->read_bytes = 0;
+  if (area->read_bytes > ofs)
+    vme->read_bytes = area->read_bytes - ofs < PGSIZE
+                      ? area->read_bytes - ofs : PGSIZE;
+  vme->zero_bytes = PGSIZE - vme->read_bytes;
+  vme->swap_slot = SWAP_ERROR;
+
+  insert_vme (&thread_current ()->vm, vme);
+  list_push_back (&area->vme_list, &vme->area_elem);
+  return vme;
 }
 
 /* Destroy given hash table. This function is called by process_exit(). */
@@ -83,6 +142,7 @@ void
 vm_destroy (struct hash *vm)
 {
   hash_destroy (vm, vm_destroy_func);
+  vma_destroy (&thread_current ()->vmas);
 }
 
 /* Required hash function to destroy hash table. 
@@ -91,40 +151,174 @@ static void
 vm_destroy_func (struct hash_elem *e, void *aux UNUSED)
 {
   struct vm_entry *vme = hash_entry (e, struct vm_entry, elem);
-  if (vme->is_loaded)
+  uint32_t *pd = thread_current ()->pagedir;
+  size_t slot = SWAP_ERROR;
+
+  /* Check and free under lru_list_lock, so that eviction cannot
+     take the page in between. */
+  lock_acquire (&lru_list_lock);
+  wait_page_io (vme);
+  /* 4 MB pages are freed with their area. */
+  if (vme->is_loaded && !pagedir_is_large_page (pd, vme->vaddr))
   {
     /* Change palloc_get_page () to free_page (). */
-    free_page (pagedir_get_page (thread_current ()->pagedir, vme->vaddr));
-    pagedir_clear_page (thread_current ()->pagedir, vme->vaddr);
+    void *kaddr = pagedir_get_page (pd, vme->vaddr);
+    /* The shared zero frame is not ours to free. */
+    struct page *page = kaddr != get_zero_frame () ? find_page (kaddr) : NULL;
+    if (page != NULL)
+      __free_page (page);
+    pagedir_clear_page (pd, vme->vaddr);
   }
-  free (vme);
+  /* Release the swap slot of a swapped out page. */
+  else if (!vme->is_loaded && vme->type == VM_ANON)
+    slot = vme->swap_slot;
+  lock_release (&lru_list_lock);
+
+  swap_free (slot);
+  free_vme (vme);
 }
 
-/* Check buffer is valid. */
-/* to_write ? Only check_address : Check vme->writable too. */
+/* Loads the page of VME if needed and pins its frame, so that it
+   stays in memory until unpinned.  With WRITE, the page gets a
+   private frame if it maps the zero frame.  Returns false if the
+   page cannot be brought in. */
+static bool
+pin_vme (struct vm_entry *vme, bool write)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+
+  /* Faulting the page in may wait for a file this thread has
+     locked. */
+  ASSERT (!filesys_lock_held ());
+
+  for (;;)
+  {
+    if (!vme->is_loaded && !handle_mm_fault (vme, write))
+      return false;
+    if (write && pagedir_get_page (pd, vme->vaddr) == get_zero_frame ()
+        && !unshare_zero_page (vme))
+      return false;
+
+    /* Eviction holds lru_list_lock, so the page cannot go away
+       between the check and the pin.  If it was evicted before,
+       load it again. */
+    lock_acquire (&lru_list_lock);
+    if (vme->is_loaded)
+    {
+      struct page *page = find_page (pagedir_get_page (pd, vme->vaddr));
+      /* The zero frame needs no pin, it is never evicted. */
+      if (page != NULL)
+        page->pinned = true;
+      lock_release (&lru_list_lock);
+      return true;
+    }
+    lock_release (&lru_list_lock);
+  }
+}
+
+/* Unpins the frame of user page UPAGE, if it has one. */
+static void
+unpin_upage (void *upage)
+{
+  void *kaddr = pagedir_get_page (thread_current ()->pagedir, upage);
+  struct page *page;
+
+  if (kaddr == NULL || kaddr == get_zero_frame ())
+    return;
+  lock_acquire (&lru_list_lock);
+  page = find_page (kaddr);
+  if (page != NULL)
+    page->pinned = false;
+  lock_release (&lru_list_lock);
+}
+
+/* Returns the vm_entry of user address ADDR, growing the stack
+   if ADDR is a valid stack access.  Exits on a bad address. */
+static struct vm_entry *
+check_user_page (void *addr, void *esp)
+{
+  struct vm_entry *vme = check_address (addr, esp);
+  if (vme == NULL)
+  {
+    if (!verify_stack (addr, esp) || !expand_stack (addr, esp))
+      syscall_exit (-1);
+    vme = find_vme (addr);
+  }
+  return vme;
+}
+
+/* Check buffer is valid, one page at a time.
+   to_write ? Only check_address : Check vme->writable too.
+   Every page of the buffer is brought in and pinned, so that the
+   system call can copy from or to it while holding file system
+   locks without taking a page fault.  Call unpin_buffer () when
+   done. */
 void
 check_valid_buffer (void *buffer, unsigned size, void *esp, bool to_write)
 {
-  void *cur_buffer = buffer;
-  int i = 0;
-  for (i = 0; i < size; i++)
+  uint8_t *start = buffer, *last, *upage;
+
+  if (size == 0)
+    return;
+  last = start + size - 1;
+  if (last < start)
+    syscall_exit (-1);
+  check_address (last, esp);
+
+  for (upage = pg_round_down (start); upage <= last; upage += PGSIZE)
   {
-    struct vm_entry *vme = check_address (cur_buffer, esp);
-    if (vme != NULL && to_write && vme->writable == false)
+    struct vm_entry *vme = check_user_page (upage < start ? start : upage,
+                                            esp);
+    if (to_write && vme->writable == false)
+      syscall_exit (-1);
+    if (!pin_vme (vme, to_write))
       syscall_exit (-1);
-
-    cur_buffer++;
   }
 }
 
-/* Check the string pointer is valid. */ 
+/* Unpins the pages pinned by check_valid_buffer (). */
+void
+unpin_buffer (void *buffer, unsigned size)
+{
+  uint8_t *start = buffer, *upage;
+
+  if (size == 0)
+    return;
+  for (upage = pg_round_down (start); upage <= start + size - 1;
+       upage += PGSIZE)
+    unpin_upage (upage);
+}
+
+/* Check the string pointer is valid, one page at a time.  The
+   pages of the string are pinned like check_valid_buffer () does,
+   call unpin_string () when done. */ 
 void
 check_valid_string (const void *str, void *esp)
 {
-  char *string = (char *)str;
-  for (; *string != 0; string += 1)
+  const char *string = str;
+  for (;;)
+  {
+    const char *page_end = (const char *) pg_round_down (string) + PGSIZE;
+    if (!pin_vme (check_user_page ((void *) string, esp), false))
+      syscall_exit (-1);
+    for (; string < page_end; string++)
+      if (*string == '\0')
+        return;
+  }
+}
+
+/* Unpins the pages pinned by check_valid_string (). */
+void
+unpin_string (const void *str)
+{
+  const char *string = str;
+  for (;;)
   {
-    check_address (str, esp);
+    const char *page_end = (const char *) pg_round_down (string) + PGSIZE;
+    unpin_upage ((void *) pg_round_down (string));
+    for (; string < page_end; string++)
+      if (*string == '\0')
+        return;
   }
 }
 
@@ -11,12 +11,13 @@
 #include "threads/thread.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/vma.h"
 
 struct mmap_file {
 	int mapid;                        /* Mapped id. */
 	struct file *file;                /* Mapped file pointer. */
 	struct list_elem elem;            /* List element of struct thread->mmap_list. */
-	struct list vme_list;             /* vm_entry lists of mapped file. */
+	struct vm_area *area;             /* Mapped area, NULL if file is empty. */
 };
 
 struct vm_entry {
@@ -25,10 +26,14 @@ struct vm_entry {
 	bool writable;                    /* True : writable, FALSE : un-writable. */
 
 	bool is_loaded;                   /* Flag for physical memory load. */
+	bool referenced;                  /* Accessed bit saved by ws_sample (). */
+	bool busy;                        /* Frame is being written out by
+	                                     eviction or the page cleaner,
+	                                     see wait_page_io (). */
 	struct file* file;                /* Mapped file with virtual address. */
 
-	/* For Memory mapped file */
-	struct list_elem mmap_elem;       /* mmap list element */
+	/* List element of struct vm_area->vme_list. */
+	struct list_elem area_elem;
 
 	size_t offset;                    /* Offset which needs read. */
 	size_t read_bytes;                /* Data size which is written in virtual page. */
@@ -45,16 +50,21 @@ struct page {
 	void *kaddr;
 	struct vm_entry *vme;
 	struct thread *thread;
+	bool pinned;                      /* Not evicted while true. */
 	struct list_elem lru;
 };
 
 void vm_init (struct hash *vm);
+void vme_cache_init (void);
+void free_vme (struct vm_entry *);
 bool insert_vme (struct hash *, struct vm_entry *);
 bool delete_vme (struct hash *, struct vm_entry *);
 struct vm_entry *find_vme (void *);
 void vm_destroy (struct hash *);
 void check_valid_buffer (void *, unsigned, void *, bool);
 void check_valid_string (const void *, void *);
+void unpin_buffer (void *, unsigned);
+void unpin_string (const void *);
 bool load_file (void *kaddr, struct vm_entry *vme);
 
 
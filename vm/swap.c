@@ -1,76 +1,356 @@
 #include "vm/swap.h"
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
 #include "threads/synch.h"
+#include "vm/zswap.h"
 
 /* Number of sectors per page. */
 /* Sector size is 512(=2^9, which is defined as BLOCK_SECTOR_SIZE),
    so we need as many sectors as (PGSIZE / BLOCK_SECTOR_SIZE) per page. */
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
-/* 4KB BITMAP SIZE. */
-/* If BITMAP SIZE is too large, then execution time is too long.
-   IF BITMAP SIZE is too small, then errors will be occured. 
-   It is important that finding a suitable bitmap size. */
-/* To make suitable BITMAPSIZE, look at the following suggestions.
-   1) PintOS uses 4MB swap size and PGSIZE is 4KB. 
-   2) PintOS is operated as block. Each page has SECTORS_PER_PAGE sectors.
-   So, (4MB / 4KB * SECTORS_PER_PAGE) = 2^13 BITMAPSIZE is maybe suitable. */
-#define BITMAPBITS 13
-#define BITMAPSIZE (1 << BITMAPBITS)
-
-struct block *block;
-struct bitmap *bitmap;
+/* Maximum number of swap devices. */
+#define SWAP_DEVICE_MAX 4
+
+/* One swap device.
+   The slot map is sized from the device, one bit per page.
+   Slots of all devices share one numbering : device N owns the
+   slots [base, base + slot_cnt). */
+struct swap_device
+{
+  struct block *block;              /* Swap block device. */
+  struct bitmap *used_map;          /* Bitmap of used slots. */
+  size_t base;                      /* First global slot number. */
+  size_t slot_cnt;                  /* Number of slots. */
+  int priority;                     /* Higher is used first. */
+
+  /* Statistics. */
+  size_t used_cnt;                  /* Slots in use. */
+  long long in_cnt;                 /* Pages read in. */
+  long long out_cnt;                /* Pages written out. */
+};
+
+/* Swap devices, sorted by descending priority. */
+static struct swap_device swap_devices[SWAP_DEVICE_MAX];
+static size_t swap_device_cnt;
+
+/* Device that got the last allocation. Devices of the same
+   priority are used round-robin, which stripes swap traffic
+   across them. */
+static size_t swap_stripe;
+
+/* Priorities requested by "-swap-pri" before swap_init (). */
+static struct
+{
+  const char *name;
+  int priority;
+} swap_pri_req[SWAP_DEVICE_MAX];
+static size_t swap_pri_req_cnt;
+
 struct lock swap_lock;
 
-void 
+static void add_swap_device (struct block *, int priority);
+static struct swap_device *slot_to_device (size_t slot);
+static size_t alloc_slots (size_t cnt);
+static void free_slot (size_t slot);
+static void swap_write_run (size_t first, void **kaddrs, size_t cnt);
+static void swap_writeback (size_t slot, void *kaddr);
+
+/* Gives swap device NAME priority PRIORITY instead of the
+   default. Must be called before swap_init (). */
+void
+swap_set_priority (const char *name, int priority)
+{
+  if (swap_pri_req_cnt >= SWAP_DEVICE_MAX)
+    PANIC ("too many swap priorities");
+  swap_pri_req[swap_pri_req_cnt].name = name;
+  swap_pri_req[swap_pri_req_cnt].priority = priority;
+  swap_pri_req_cnt++;
+}
+
+/* Uses every block device with the swap role or type as swap.
+   The device given by the swap role gets priority 1 and the
+   others priority 0, unless "-swap-pri" says otherwise. */
+void
 swap_init (void)
 {
-  block = block_get_role (BLOCK_SWAP);
-  if (block == NULL)
+  struct block *role = block_get_role (BLOCK_SWAP);
+  struct block *b;
+
+  lock_init (&swap_lock);
+
+  if (role != NULL)
+    add_swap_device (role, 1);
+  for (b = block_first (); b != NULL; b = block_next (b))
+    if (b != role && block_type (b) == BLOCK_SWAP)
+      add_swap_device (b, 0);
+
+  if (swap_device_cnt > 0)
+    zswap_init (swap_writeback);
+}
+
+/* Adds block device B as swap device with default PRIORITY,
+   keeping swap_devices sorted by priority. */
+static void
+add_swap_device (struct block *b, int priority)
+{
+  struct swap_device *d;
+  size_t i, slot_cnt;
+
+  if (swap_device_cnt >= SWAP_DEVICE_MAX)
+  {
+    printf ("swap: too many swap devices, ignoring %s\n", block_name (b));
     return;
+  }
 
-  bitmap = bitmap_create (BITMAPSIZE);
-  if (bitmap == NULL)
+  slot_cnt = block_size (b) / SECTORS_PER_PAGE;
+  if (slot_cnt == 0)
     return;
 
-  bitmap_set_all (bitmap, false);
-  lock_init (&swap_lock);
+  for (i = 0; i < swap_pri_req_cnt; i++)
+    if (!strcmp (swap_pri_req[i].name, block_name (b)))
+      priority = swap_pri_req[i].priority;
+
+  /* Insertion keeps equal priorities in probe order. */
+  for (i = swap_device_cnt; i > 0; i--)
+  {
+    if (swap_devices[i - 1].priority >= priority)
+      break;
+    swap_devices[i] = swap_devices[i - 1];
+  }
+
+  d = &swap_devices[i];
+  memset (d, 0, sizeof *d);
+  d->block = b;
+  d->slot_cnt = slot_cnt;
+  d->priority = priority;
+  d->used_map = bitmap_create (slot_cnt);
+  if (d->used_map == NULL)
+    PANIC ("swap: bitmap creation failed for %s", block_name (b));
+  swap_device_cnt++;
+
+  /* Renumber the global slot ranges. */
+  for (i = 0; i < swap_device_cnt; i++)
+    swap_devices[i].base = i == 0 ? 0 : swap_devices[i - 1].base
+                                        + swap_devices[i - 1].slot_cnt;
+
+  printf ("swap: %s, %zu slots, priority %d\n",
+          block_name (b), slot_cnt, priority);
+}
+
+/* Returns the swap device that owns global SLOT. */
+static struct swap_device *
+slot_to_device (size_t slot)
+{
+  size_t i;
+  for (i = 0; i < swap_device_cnt; i++)
+    if (slot - swap_devices[i].base < swap_devices[i].slot_cnt)
+      return &swap_devices[i];
+  PANIC ("swap: bad slot %zu", slot);
+}
+
+/* Allocates CNT contiguous slots on one device and returns the
+   first global slot, or SWAP_ERROR.
+   The highest priority devices with room are tried first,
+   round-robin among devices of equal priority.
+   swap_lock must be held. */
+static size_t
+alloc_slots (size_t cnt)
+{
+  size_t i, j;
+
+  for (i = 0; i < swap_device_cnt; )
+  {
+    /* Devices [i, j) share one priority. */
+    for (j = i; j < swap_device_cnt
+                && swap_devices[j].priority == swap_devices[i].priority; j++)
+      continue;
+
+    size_t n = j - i, k;
+    size_t start = swap_stripe >= i && swap_stripe < j
+                   ? swap_stripe - i + 1 : 0;
+    for (k = 0; k < n; k++)
+    {
+      size_t idx = i + (start + k) % n;
+      struct swap_device *d = &swap_devices[idx];
+      size_t local = bitmap_scan_and_flip (d->used_map, 0, cnt, false);
+      if (local != BITMAP_ERROR)
+      {
+        swap_stripe = idx;
+        d->used_cnt += cnt;
+        return d->base + local;
+      }
+    }
+    i = j;
+  }
+
+  return SWAP_ERROR;
+}
+
+/* Releases global SLOT. swap_lock must be held. */
+static void
+free_slot (size_t slot)
+{
+  struct swap_device *d = slot_to_device (slot);
+  ASSERT (bitmap_test (d->used_map, slot - d->base));
+  zswap_invalidate (slot);
+  bitmap_reset (d->used_map, slot - d->base);
+  d->used_cnt--;
 }
 
-void 
+/* Reads the page in slot USED_INDEX into KADDR.  The slot stays
+   allocated, so that the page is not lost if it cannot be mapped;
+   the caller releases it with swap_free () afterwards. */
+void
 swap_in (size_t used_index, void *kaddr)
 {
+  struct swap_device *d;
+  block_sector_t sector;
   int i = 0;
 
-  if (block == NULL || bitmap == NULL)
+  if (swap_device_cnt == 0 || used_index == SWAP_ERROR)
     return;
 
   lock_acquire (&swap_lock);
-  bitmap_flip (bitmap, used_index);
+  d = slot_to_device (used_index);
+  sector = (used_index - d->base) * SECTORS_PER_PAGE;
 
-  for (i = 0; i < SECTORS_PER_PAGE; i++)
-    block_read (block, used_index * SECTORS_PER_PAGE + i, 
-                (char *) kaddr + BLOCK_SECTOR_SIZE * i);
+  /* Read from the disk only if the compressed pool missed. */
+  if (!zswap_load (used_index, kaddr))
+  {
+    for (i = 0; i < SECTORS_PER_PAGE; i++)
+      block_read (d->block, sector + i,
+                  (char *) kaddr + BLOCK_SECTOR_SIZE * i);
+    d->in_cnt++;
+  }
   lock_release (&swap_lock);
 }
 
-size_t 
+/* Writes page KADDR to swap and returns its slot, or SWAP_ERROR
+   if there is no swap device or no free slot. */
+size_t
 swap_out (void *kaddr)
 {
-  int i;
   size_t slot_num;
 
-  if (block == NULL || bitmap == NULL)
-    return;
+  if (!swap_out_cluster (&kaddr, &slot_num, 1))
+    return SWAP_ERROR;
+
+  return slot_num;
+}
+
+/* Write CNT pages KADDRS[] to swap, storing the slot of each
+   page to SLOTS[].  Pages are placed in one run of contiguous
+   slots if possible, so that the whole cluster goes to disk as
+   a single sequential transfer and can be read ahead later.
+   If no run is large enough, each page gets its own slot.
+   Returns false, with no slot allocated, if swap is full. */
+bool
+swap_out_cluster (void **kaddrs, size_t *slots, size_t cnt)
+{
+  bool to_disk[SWAP_CLUSTER_PAGES];
+  size_t first, i;
+
+  if (swap_device_cnt == 0)
+    return false;
 
   lock_acquire (&swap_lock);
-  /* Find empty bitmap slot using First fit. */
-  slot_num = bitmap_scan_and_flip (bitmap, 0, 1, false);
+  first = alloc_slots (cnt);
+  if (first != SWAP_ERROR)
+  {
+    for (i = 0; i < cnt; i++)
+      slots[i] = first + i;
+  }
+  else
+  {
+    for (i = 0; i < cnt; i++)
+    {
+      slots[i] = alloc_slots (1);
+      if (slots[i] == SWAP_ERROR)
+      {
+        while (i-- > 0)
+          free_slot (slots[i]);
+        lock_release (&swap_lock);
+        return false;
+      }
+    }
+  }
 
-  for (i = 0; i < SECTORS_PER_PAGE; i++)
-    block_write (block, slot_num * SECTORS_PER_PAGE + i, 
-                 (char *) kaddr + BLOCK_SECTOR_SIZE * i);
+  /* Pages that compress well stay in memory.  The rest goes to
+     disk, each run of consecutive slots in one write. */
+  ASSERT (cnt <= SWAP_CLUSTER_PAGES);
+  for (i = 0; i < cnt; i++)
+    to_disk[i] = !zswap_store (slots[i], kaddrs[i]);
+  for (i = 0; i < cnt; )
+  {
+    size_t run = 0;
+    while (i + run < cnt && to_disk[i + run]
+           && slots[i + run] == slots[i] + run)
+      run++;
+    if (run > 0)
+      swap_write_run (slots[i], &kaddrs[i], run);
+    i += run > 0 ? run : 1;
+  }
   lock_release (&swap_lock);
 
-  return slot_num;
+  return true;
 }
 
+/* Releases SLOT without reading it, for swapped-out pages of
+   an exiting process. */
+void
+swap_free (size_t slot)
+{
+  if (swap_device_cnt == 0 || slot == SWAP_ERROR)
+    return;
+
+  lock_acquire (&swap_lock);
+  free_slot (slot);
+  lock_release (&swap_lock);
+}
+
+/* Write CNT pages KADDRS[] to the contiguous slots starting at
+   FIRST, which all live on one device.  The sectors of the run
+   are issued in ascending order, so the disk sees one sequential
+   multi-sector write.  swap_lock must be held. */
+static void
+swap_write_run (size_t first, void **kaddrs, size_t cnt)
+{
+  struct swap_device *d = slot_to_device (first);
+  block_sector_t sector = (first - d->base) * SECTORS_PER_PAGE;
+  size_t i;
+  int j;
+
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+  ASSERT (first - d->base + cnt <= d->slot_cnt);
+
+  for (i = 0; i < cnt; i++)
+    for (j = 0; j < SECTORS_PER_PAGE; j++)
+      block_write (d->block, sector++,
+                   (char *) kaddrs[i] + BLOCK_SECTOR_SIZE * j);
+  d->out_cnt += cnt;
+}
+
+/* Write back an entry evicted from the compressed pool.
+   swap_lock is held by our caller. */
+static void
+swap_writeback (size_t slot, void *kaddr)
+{
+  swap_write_run (slot, &kaddr, 1);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  size_t i;
+  for (i = 0; i < swap_device_cnt; i++)
+  {
+    struct swap_device *d = &swap_devices[i];
+    printf ("Swap: %s: %zu of %zu slots used, %lld pages in, "
+            "%lld pages out\n", block_name (d->block), d->used_cnt,
+            d->slot_cnt, d->in_cnt, d->out_cnt);
+  }
+  zswap_print_stats ();
+}
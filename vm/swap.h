@@ -1,13 +1,29 @@
 #ifndef VM_SWAP_H_
 #define VM_SWAP_H_
 
+#include <stdint.h>
 #include "threads/vaddr.h"
 #include "vm/page.h"
 #include "lib/kernel/bitmap.h"
 #include "devices/block.h"
 
+/* Maximum number of anonymous pages written out as one cluster
+   of contiguous swap slots. */
+#define SWAP_CLUSTER_PAGES 8
+
+/* Maximum number of neighbouring pages read in together with a
+   faulting swapped-out page. */
+#define SWAP_READ_AHEAD 4
+
+/* Returned by swap_out () when no slot is available. */
+#define SWAP_ERROR SIZE_MAX
+
+void swap_set_priority (const char *name, int priority);
 void swap_init (void);
 void swap_in (size_t, void *);
 size_t swap_out (void *);
+bool swap_out_cluster (void **kaddrs, size_t *slots, size_t cnt);
+void swap_free (size_t);
+void swap_print_stats (void);
 
 #endif
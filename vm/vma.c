@@ -0,0 +1,257 @@
+#include "vm/vma.h"
+#include <debug.h>
+#include <syscall-nr.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+
+static int height (struct vm_area *);
+static struct vm_area *rebalance (struct vm_area *);
+static struct vm_area *insert_node (struct vm_area *, struct vm_area *);
+static struct vm_area *remove_node (struct vm_area *, struct vm_area *);
+static struct vm_area *floor_node (struct vm_area *, const void *addr);
+static void destroy_node (struct vm_area *);
+static void free_area (struct vm_area *);
+
+/* Initializes TREE as empty. */
+void
+vma_init (struct vma_tree *tree)
+{
+  tree->root = NULL;
+  tree->cnt = 0;
+}
+
+/* Allocates an area for pages [START, END).  The first
+   READ_BYTES bytes come from FILE at OFFSET, the rest is
+   zero-filled.  Returns NULL if memory is short. */
+struct vm_area *
+vma_create (void *start, void *end, uint8_t type, bool writable,
+            struct file *file, size_t offset, size_t read_bytes)
+{
+  struct vm_area *area = malloc (sizeof *area);
+  if (area == NULL)
+    return NULL;
+
+  area->start = start;
+  area->end = end;
+  area->type = type;
+  area->writable = writable;
+  area->file = file;
+  area->offset = offset;
+  area->read_bytes = read_bytes;
+  list_init (&area->vme_list);
+  area->advice = MADV_NORMAL;
+  area->large = NULL;
+  area->left = area->right = NULL;
+  area->height = 1;
+  return area;
+}
+
+/* Inserts AREA into TREE.  Returns false, leaving TREE alone, if
+   AREA overlaps an area already in TREE. */
+bool
+vma_insert (struct vma_tree *tree, struct vm_area *area)
+{
+  ASSERT (area->start < area->end);
+
+  if (vma_overlaps (tree, area->start, area->end))
+    return false;
+  tree->root = insert_node (tree->root, area);
+  tree->cnt++;
+  return true;
+}
+
+/* Removes AREA from TREE and frees it.  The vm_entries of AREA
+   must be gone already. */
+void
+vma_remove (struct vma_tree *tree, struct vm_area *area)
+{
+  tree->root = remove_node (tree->root, area);
+  tree->cnt--;
+  free_area (area);
+}
+
+/* Returns the area of TREE that contains VADDR, or NULL. */
+struct vm_area *
+vma_find (struct vma_tree *tree, const void *vaddr)
+{
+  struct vm_area *area = floor_node (tree->root, (const char *) vaddr + 1);
+  return area != NULL && vaddr < area->end ? area : NULL;
+}
+
+/* Returns true if any area of TREE overlaps [START, END). */
+bool
+vma_overlaps (struct vma_tree *tree, const void *start, const void *end)
+{
+  struct vm_area *area = floor_node (tree->root, end);
+  return area != NULL && area->end > start;
+}
+
+/* Frees every area of TREE.  Called at process exit after the
+   vm_entries are destroyed. */
+void
+vma_destroy (struct vma_tree *tree)
+{
+  destroy_node (tree->root);
+  vma_init (tree);
+}
+
+/* Returns the frame of the 4 MB page of AREA that holds VADDR,
+   or NULL if VADDR is mapped with 4 kB pages. */
+void *
+vma_large_frame (struct vm_area *area, const void *vaddr)
+{
+  if (area->large == NULL)
+    return NULL;
+  return area->large[pd_no (vaddr) - pd_no (area->start)];
+}
+
+/* Frees AREA along with its 4 MB pages. */
+static void
+free_area (struct vm_area *area)
+{
+  if (area->large != NULL)
+  {
+    size_t i, n = pd_no ((uint8_t *) area->end - 1) - pd_no (area->start) + 1;
+    for (i = 0; i < n; i++)
+      palloc_free_multiple (area->large[i], LARGE_PGPAGES);
+    free (area->large);
+  }
+  free (area);
+}
+
+static int
+height (struct vm_area *n)
+{
+  return n != NULL ? n->height : 0;
+}
+
+static void
+update_height (struct vm_area *n)
+{
+  int l = height (n->left), r = height (n->right);
+  n->height = (l > r ? l : r) + 1;
+}
+
+static struct vm_area *
+rotate_right (struct vm_area *n)
+{
+  struct vm_area *l = n->left;
+  n->left = l->right;
+  l->right = n;
+  update_height (n);
+  update_height (l);
+  return l;
+}
+
+static struct vm_area *
+rotate_left (struct vm_area *n)
+{
+  struct vm_area *r = n->right;
+  n->right = r->left;
+  r->left = n;
+  update_height (n);
+  update_height (r);
+  return r;
+}
+
+/* Restores the AVL property at N, whose subtrees differ in
+   height by at most 2, and returns the new subtree root. */
+static struct vm_area *
+rebalance (struct vm_area *n)
+{
+  int balance;
+
+  update_height (n);
+  balance = height (n->left) - height (n->right);
+  if (balance > 1)
+  {
+    if (height (n->left->left) < height (n->left->right))
+      n->left = rotate_left (n->left);
+    return rotate_right (n);
+  }
+  if (balance < -1)
+  {
+    if (height (n->right->right) < height (n->right->left))
+      n->right = rotate_right (n->right);
+    return rotate_left (n);
+  }
+  return n;
+}
+
+static struct vm_area *
+insert_node (struct vm_area *n, struct vm_area *area)
+{
+  if (n == NULL)
+    return area;
+  if (area->start < n->start)
+    n->left = insert_node (n->left, area);
+  else
+    n->right = insert_node (n->right, area);
+  return rebalance (n);
+}
+
+/* Unlinks the leftmost node of N, storing it in *MIN. */
+static struct vm_area *
+remove_min (struct vm_area *n, struct vm_area **min)
+{
+  if (n->left == NULL)
+  {
+    *min = n;
+    return n->right;
+  }
+  n->left = remove_min (n->left, min);
+  return rebalance (n);
+}
+
+static struct vm_area *
+remove_node (struct vm_area *n, struct vm_area *area)
+{
+  ASSERT (n != NULL);
+
+  if (area->start < n->start)
+    n->left = remove_node (n->left, area);
+  else if (area->start > n->start)
+    n->right = remove_node (n->right, area);
+  else
+  {
+    struct vm_area *min;
+
+    ASSERT (n == area);
+    if (n->right == NULL)
+      return n->left;
+    n->right = remove_min (n->right, &min);
+    min->left = n->left;
+    min->right = n->right;
+    n = min;
+  }
+  return rebalance (n);
+}
+
+/* Returns the node of N with the greatest start below ADDR. */
+static struct vm_area *
+floor_node (struct vm_area *n, const void *addr)
+{
+  struct vm_area *best = NULL;
+  while (n != NULL)
+  {
+    if (n->start < addr)
+    {
+      best = n;
+      n = n->right;
+    }
+    else
+      n = n->left;
+  }
+  return best;
+}
+
+static void
+destroy_node (struct vm_area *n)
+{
+  if (n == NULL)
+    return;
+  destroy_node (n->left);
+  destroy_node (n->right);
+  free_area (n);
+}
@@ -0,0 +1,60 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pages mapped after a fault on a mapped file: with the default
+   advice, and with MADV_SEQUENTIAL. */
+#define MMAP_FAULT_AROUND_PAGES 4
+#define MMAP_READ_AHEAD_PAGES 16
+
+/* Virtual memory area: the pages [start, end) of a process that
+   share one type, backing file and protection.  The vm_entry of
+   a page is created from its area only when the page is first
+   looked up, so mapping a region costs one area, not one entry
+   per page. */
+struct vm_area
+{
+  void *start;                      /* First page. */
+  void *end;                        /* One past the last page. */
+  uint8_t type;                     /* VM_BIN, VM_FILE or VM_ANON. */
+  bool writable;                    /* True if pages may be written. */
+  struct file *file;                /* Backing file, if any. */
+  size_t offset;                    /* File offset of START. */
+  size_t read_bytes;                /* File bytes from START, the rest
+                                       of the area is zero-filled. */
+  struct list vme_list;             /* vm_entries created so far. */
+  int advice;                       /* MADV_* given by madvise (). */
+  void **large;                     /* Frame of each 4 MB chunk of the
+                                       area mapped as a large page,
+                                       indexed from START's chunk, or
+                                       NULL if there is none. */
+
+  /* AVL tree element, keyed by START. */
+  struct vm_area *left;
+  struct vm_area *right;
+  int height;
+};
+
+/* Areas of one process, which never overlap. */
+struct vma_tree
+{
+  struct vm_area *root;
+  size_t cnt;                       /* Number of areas. */
+};
+
+void vma_init (struct vma_tree *);
+struct vm_area *vma_create (void *start, void *end, uint8_t type,
+                            bool writable, struct file *,
+                            size_t offset, size_t read_bytes);
+bool vma_insert (struct vma_tree *, struct vm_area *);
+void vma_remove (struct vma_tree *, struct vm_area *);
+struct vm_area *vma_find (struct vma_tree *, const void *vaddr);
+bool vma_overlaps (struct vma_tree *, const void *start, const void *end);
+void vma_destroy (struct vma_tree *);
+void *vma_large_frame (struct vm_area *, const void *vaddr);
+
+#endif
@@ -0,0 +1,377 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap cache.
+
+   Pages evicted to swap are first compressed and kept in memory
+   allocated with malloc (), keyed by the swap slot that swap.c
+   already reserved for them.  A later swap_in () of the slot is
+   served from memory without touching the disk.  When the pool
+   reaches its size limit, the oldest entries are decompressed
+   and written back to their slots on the swap device.
+
+   All functions are called by swap.c with swap_lock held. */
+
+/* Largest compressed page kept in the pool.  Anything bigger
+   does not fit the largest malloc () block size and isn't worth
+   keeping. */
+#define ZSWAP_MAX_LEN 1024
+
+/* One compressed page. */
+struct zswap_entry
+{
+  size_t slot;                      /* Swap slot of the page. */
+  size_t len;                       /* Compressed length, 0 if zero page. */
+  uint8_t *data;                    /* Compressed data. */
+  struct hash_elem elem;            /* Element of zswap_table. */
+  struct list_elem lru;             /* Element of zswap_lru. */
+};
+
+static struct hash zswap_table;     /* Entries by slot. */
+static struct list zswap_lru;       /* Entries, oldest first. */
+static size_t zswap_limit = ZSWAP_DEFAULT_PAGES * PGSIZE;
+static size_t zswap_bytes;          /* Bytes of compressed data. */
+static bool zswap_enabled;
+static zswap_writeback_func *zswap_writeback;
+static void *writeback_page;        /* Decompression buffer. */
+
+/* Statistics. */
+static long long store_cnt;         /* Pages stored. */
+static long long reject_cnt;        /* Pages too big to store. */
+static long long hit_cnt;           /* swap_in () served from pool. */
+static long long miss_cnt;          /* swap_in () read from disk. */
+static long long writeback_cnt;     /* Entries written to disk. */
+static long long stored_bytes;      /* Compressed bytes of all stores. */
+
+/* LZ compression.
+   The compressed stream is a sequence of tokens.  A control byte
+   C below 0x80 is followed by C + 1 literal bytes.  Otherwise it
+   is a match of (C & 0x7f) + LZ_MIN_MATCH bytes, copied from the
+   16-bit little-endian distance that follows. */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERAL 0x80
+#define LZ_HASH_BITS 12
+
+static uint16_t lz_table[1 << LZ_HASH_BITS];  /* Position + 1. */
+static uint8_t lz_buf[ZSWAP_MAX_LEN];
+
+static unsigned zswap_hash (const struct hash_elem *, void *);
+static bool zswap_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
+static struct zswap_entry *zswap_find (size_t slot);
+static void zswap_remove (struct zswap_entry *);
+static bool zswap_shrink (size_t len);
+static size_t lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_len);
+static void lz_decompress (const uint8_t *src, size_t len, uint8_t *dst);
+
+/* Limits the pool to PAGE_CNT pages of compressed data, 0
+   disables it.  Must be called before zswap_init (). */
+void
+zswap_set_limit (size_t page_cnt)
+{
+  zswap_limit = page_cnt * PGSIZE;
+}
+
+/* Initializes the pool.  Evicted entries go through WRITEBACK. */
+void
+zswap_init (zswap_writeback_func *writeback)
+{
+  if (zswap_limit == 0)
+    return;
+
+  writeback_page = palloc_get_page (0);
+  if (writeback_page == NULL)
+    return;
+
+  hash_init (&zswap_table, zswap_hash, zswap_less, NULL);
+  list_init (&zswap_lru);
+  zswap_writeback = writeback;
+  zswap_enabled = true;
+}
+
+/* Compresses page KADDR into the pool under SLOT.  Returns false
+   if the page does not compress well enough, in which case the
+   caller must write it to disk itself. */
+bool
+zswap_store (size_t slot, const void *kaddr)
+{
+  struct zswap_entry *e;
+  size_t len;
+
+  if (!zswap_enabled)
+    return false;
+
+  /* A page that is all zeros needs no data at all. */
+  if (((const uint8_t *) kaddr)[0] == 0
+      && !memcmp (kaddr, (const uint8_t *) kaddr + 1, PGSIZE - 1))
+    len = 0;
+  else
+  {
+    len = lz_compress (kaddr, lz_buf, sizeof lz_buf);
+    if (len == 0)
+    {
+      reject_cnt++;
+      return false;
+    }
+  }
+
+  if (!zswap_shrink (len))
+    return false;
+
+  e = malloc (sizeof *e);
+  if (e == NULL)
+    return false;
+  e->data = NULL;
+  if (len > 0)
+  {
+    e->data = malloc (len);
+    if (e->data == NULL)
+    {
+      free (e);
+      return false;
+    }
+    memcpy (e->data, lz_buf, len);
+  }
+  e->slot = slot;
+  e->len = len;
+
+  ASSERT (zswap_find (slot) == NULL);
+  hash_insert (&zswap_table, &e->elem);
+  list_push_back (&zswap_lru, &e->lru);
+  zswap_bytes += len;
+
+  store_cnt++;
+  stored_bytes += len;
+  return true;
+}
+
+/* If SLOT is in the pool, decompresses it into KADDR and returns
+   true.  The entry stays until the slot is freed.  Otherwise
+   returns false and the page must be read from disk. */
+bool
+zswap_load (size_t slot, void *kaddr)
+{
+  struct zswap_entry *e;
+
+  if (!zswap_enabled)
+    return false;
+
+  e = zswap_find (slot);
+  if (e == NULL)
+  {
+    miss_cnt++;
+    return false;
+  }
+
+  if (e->len == 0)
+    memset (kaddr, 0, PGSIZE);
+  else
+    lz_decompress (e->data, e->len, kaddr);
+  hit_cnt++;
+  return true;
+}
+
+/* Drops SLOT from the pool, if present. */
+void
+zswap_invalidate (size_t slot)
+{
+  struct zswap_entry *e;
+
+  if (!zswap_enabled)
+    return;
+
+  e = zswap_find (slot);
+  if (e != NULL)
+    zswap_remove (e);
+}
+
+/* Prints pool statistics. */
+void
+zswap_print_stats (void)
+{
+  long long loads = hit_cnt + miss_cnt;
+
+  if (!zswap_enabled)
+    return;
+
+  printf ("Zswap: %lld stored, %lld rejected, %lld written back, "
+          "%zu bytes in use\n",
+          store_cnt, reject_cnt, writeback_cnt, zswap_bytes);
+  printf ("Zswap: hit rate %lld%% (%lld of %lld), compression ratio "
+          "%lld%%\n",
+          loads > 0 ? hit_cnt * 100 / loads : 0, hit_cnt, loads,
+          store_cnt > 0 ? stored_bytes * 100 / (store_cnt * PGSIZE) : 0);
+}
+
+/* Required hash function for hash structure. */
+static unsigned
+zswap_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct zswap_entry, elem)->slot);
+}
+
+/* Required less function for hash structure. */
+static bool
+zswap_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct zswap_entry, elem)->slot
+         < hash_entry (b, struct zswap_entry, elem)->slot;
+}
+
+/* Returns the entry of SLOT, or NULL. */
+static struct zswap_entry *
+zswap_find (size_t slot)
+{
+  struct zswap_entry key;
+  struct hash_elem *e;
+
+  key.slot = slot;
+  e = hash_find (&zswap_table, &key.elem);
+  return e != NULL ? hash_entry (e, struct zswap_entry, elem) : NULL;
+}
+
+/* Removes E from the pool and frees it. */
+static void
+zswap_remove (struct zswap_entry *e)
+{
+  hash_delete (&zswap_table, &e->elem);
+  list_remove (&e->lru);
+  zswap_bytes -= e->len;
+  free (e->data);
+  free (e);
+}
+
+/* Writes back the oldest entries until LEN more bytes fit in
+   the pool.  Returns false if that is impossible. */
+static bool
+zswap_shrink (size_t len)
+{
+  if (len > zswap_limit)
+    return false;
+
+  while (zswap_bytes + len > zswap_limit && !list_empty (&zswap_lru))
+  {
+    struct zswap_entry *e = list_entry (list_front (&zswap_lru),
+                                        struct zswap_entry, lru);
+    if (e->len == 0)
+      memset (writeback_page, 0, PGSIZE);
+    else
+      lz_decompress (e->data, e->len, writeback_page);
+    zswap_writeback (e->slot, writeback_page);
+    zswap_remove (e);
+    writeback_cnt++;
+  }
+
+  return zswap_bytes + len <= zswap_limit;
+}
+
+/* Returns hash of the LZ_MIN_MATCH bytes at P. */
+static inline unsigned
+lz_hash (const uint8_t *p)
+{
+  uint32_t v = p[0] | p[1] << 8 | p[2] << 16;
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends literals SRC[START, END) to DST at *OP.
+   Returns false if DST_LEN bytes are not enough. */
+static bool
+lz_literals (const uint8_t *src, size_t start, size_t end,
+             uint8_t *dst, size_t *op, size_t dst_len)
+{
+  while (start < end)
+  {
+    size_t n = end - start < LZ_MAX_LITERAL ? end - start : LZ_MAX_LITERAL;
+    if (*op + 1 + n > dst_len)
+      return false;
+    dst[(*op)++] = n - 1;
+    memcpy (dst + *op, src + start, n);
+    *op += n;
+    start += n;
+  }
+  return true;
+}
+
+/* Compresses the page at SRC into DST, which holds DST_LEN
+   bytes.  Returns the compressed length, or 0 if it doesn't
+   fit. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_len)
+{
+  size_t ip = 0, op = 0, lit = 0;
+
+  memset (lz_table, 0, sizeof lz_table);
+  while (ip + LZ_MIN_MATCH <= PGSIZE)
+  {
+    unsigned h = lz_hash (src + ip);
+    size_t cand = lz_table[h];
+    lz_table[h] = ip + 1;
+
+    if (cand != 0 && !memcmp (src + cand - 1, src + ip, LZ_MIN_MATCH))
+    {
+      size_t ref = cand - 1;
+      size_t len = LZ_MIN_MATCH;
+      size_t dist = ip - ref;
+
+      while (len < LZ_MAX_MATCH && ip + len < PGSIZE
+             && src[ref + len] == src[ip + len])
+        len++;
+
+      if (!lz_literals (src, lit, ip, dst, &op, dst_len)
+          || op + 3 > dst_len)
+        return 0;
+      dst[op++] = 0x80 | (len - LZ_MIN_MATCH);
+      dst[op++] = dist & 0xff;
+      dst[op++] = dist >> 8;
+      ip += len;
+      lit = ip;
+    }
+    else
+      ip++;
+  }
+
+  if (!lz_literals (src, lit, PGSIZE, dst, &op, dst_len))
+    return 0;
+  return op;
+}
+
+/* Decompresses LEN bytes at SRC into the page at DST. */
+static void
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst)
+{
+  size_t ip = 0, op = 0;
+
+  while (ip < len)
+  {
+    uint8_t c = src[ip++];
+    if (c & 0x80)
+    {
+      size_t n = (c & 0x7f) + LZ_MIN_MATCH;
+      size_t dist = src[ip] | src[ip + 1] << 8;
+      ip += 2;
+      ASSERT (dist > 0 && dist <= op && op + n <= PGSIZE);
+      /* Byte by byte, the source may overlap the destination. */
+      for (; n > 0; n--, op++)
+        dst[op] = dst[op - dist];
+    }
+    else
+    {
+      size_t n = c + 1;
+      ASSERT (op + n <= PGSIZE);
+      memcpy (dst + op, src + ip, n);
+      ip += n;
+      op += n;
+    }
+  }
+  ASSERT (op == PGSIZE);
+}
@@ -0,0 +1,21 @@
+#ifndef VM_ZSWAP_H_
+#define VM_ZSWAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Default size limit of the compressed pool, in pages. */
+#define ZSWAP_DEFAULT_PAGES 64
+
+/* Called to write an entry evicted from the pool to its slot on
+   the swap device. */
+typedef void zswap_writeback_func (size_t slot, void *kaddr);
+
+void zswap_set_limit (size_t page_cnt);
+void zswap_init (zswap_writeback_func *);
+bool zswap_store (size_t slot, const void *kaddr);
+bool zswap_load (size_t slot, void *kaddr);
+void zswap_invalidate (size_t slot);
+void zswap_print_stats (void);
+
+#endif